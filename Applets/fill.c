@@ -0,0 +1,81 @@
+/*******************************************************************************
+ * @file    fill.c
+ * @author  Mohammed Khaled
+ * @email   Mohammed.kh384@gmail.com
+ * @website EMSTutorials.blogspot.com/
+ * @Created on: Apr 12, 2023
+ *
+ * @brief   flash applet : bulk fill of DST with the 32-bit pattern PARAM.
+ * @note	Nothing crosses the link but the call, the pattern is programmed a chunk at
+ * 			a time from the stack. DST must be word aligned, SRC is unused and Result is
+ * 			the number of bytes written. An erased pattern only erases DST.
+ *
+@verbatim
+Copyright (C) EMSTutorials, 2019
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+@endverbatim
+*******************************************************************************/
+
+/**************** Includes ********************/
+#include "boot_applet.h"
+
+
+#define 	FILL_CHUNK				64U			// bytes programmed per call, on the stack.
+
+static uint32_t FILL(APPLET_ArgsType *pArgs);
+
+extern const uint8_t _applet_end[];
+
+__attribute__((section(".applet_header"), used))
+const APPLET_HeaderType AppletHeader = {
+		APPLET_MAGIC,
+		APPLET_ABI_VERSION,
+		(uint32_t) _applet_end,
+		(uint32_t) FILL };
+
+
+/**
+ * @brief	Applet entry
+ * @param   pArgs: PARAM pattern, DST area to fill
+ * @retval  APPLET_OK, APPLET_ERR_ARGS or APPLET_ERR_FLASH
+ */
+static uint32_t FILL(APPLET_ArgsType *pArgs){
+
+	const APPLET_ServicesType *pServices = pArgs->pServices;
+	uint32_t chunk[FILL_CHUNK >> 2U];
+	uint32_t Address = pArgs->Dst.Address;
+	uint32_t remaining = pArgs->Dst.Size;
+
+	if (((Address | remaining) & 0x3U) != 0U)
+		return APPLET_ERR_ARGS;
+
+	for (uint32_t idx = 0; idx < (FILL_CHUNK >> 2U); ++idx)
+		chunk[idx] = pArgs->Param;
+
+	if (pServices->Prepare(Address, remaining) != 0U)
+		return APPLET_ERR_FLASH;
+
+	while (remaining != 0U)
+	{
+		uint32_t size = (remaining < FILL_CHUNK) ? remaining : FILL_CHUNK;
+
+		if (pServices->Program(Address, (const uint8_t*) chunk, size) != 0U)
+			return APPLET_ERR_FLASH;
+
+		Address += size;
+		remaining -= size;
+		pArgs->Result += size;
+	}
+
+	return APPLET_OK;
+}
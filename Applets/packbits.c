@@ -0,0 +1,106 @@
+/*******************************************************************************
+ * @file    packbits.c
+ * @author  Mohammed Khaled
+ * @email   Mohammed.kh384@gmail.com
+ * @website EMSTutorials.blogspot.com/
+ * @Created on: Apr 12, 2023
+ *
+ * @brief   flash applet : PackBits decoder, SRC (in the RAM area) is decoded into DST.
+ * @note	A control byte N of 0 to 127 is followed by N + 1 literal bytes, 129 to 255
+ * 			by one byte repeated 257 - N times, 128 is ignored. The output goes through
+ * 			the coalesced writes, so DST may have any alignment and length. Result is the
+ * 			number of bytes written, APPLET_ERR_DATA when SRC is truncated or doesn't fit
+ * 			DST. A simple example of a custom compression kernel.
+ *
+@verbatim
+Copyright (C) EMSTutorials, 2019
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+@endverbatim
+*******************************************************************************/
+
+/**************** Includes ********************/
+#include "boot_applet.h"
+
+
+#define 	RUN_CHUNK				32U			// bytes of a run written per call, on the stack.
+
+static uint32_t PACKBITS(APPLET_ArgsType *pArgs);
+
+extern const uint8_t _applet_end[];
+
+__attribute__((section(".applet_header"), used))
+const APPLET_HeaderType AppletHeader = {
+		APPLET_MAGIC,
+		APPLET_ABI_VERSION,
+		(uint32_t) _applet_end,
+		(uint32_t) PACKBITS };
+
+
+/**
+ * @brief	Applet entry
+ * @param   pArgs: SRC PackBits stream, DST output area
+ * @retval  APPLET_OK, APPLET_ERR_DATA or APPLET_ERR_FLASH
+ */
+static uint32_t PACKBITS(APPLET_ArgsType *pArgs){
+
+	const APPLET_ServicesType *pServices = pArgs->pServices;
+	const uint8_t *pSrc = (const uint8_t*) pArgs->Src.Address;
+	const uint8_t *pEnd = pSrc + pArgs->Src.Size;
+	uint32_t Address = pArgs->Dst.Address;
+	uint32_t room = pArgs->Dst.Size;
+	uint8_t run[RUN_CHUNK];
+
+	while (pSrc < pEnd)
+	{
+		uint8_t control = *pSrc++;
+		uint32_t count;
+
+		if (control == 128U)
+			continue;
+
+		if (control < 128U)
+		{
+			count = control + 1U;
+			if (count > (uint32_t)(pEnd - pSrc) || count > room)
+				return APPLET_ERR_DATA;
+
+			if (pServices->Write(Address, pSrc, count) != 0U)
+				return APPLET_ERR_FLASH;
+			pSrc += count;
+		}
+		else
+		{
+			count = 257U - control;
+			if (pSrc == pEnd || count > room)
+				return APPLET_ERR_DATA;
+
+			for (uint32_t idx = 0; idx < RUN_CHUNK; ++idx)
+				run[idx] = *pSrc;
+			pSrc++;
+
+			for (uint32_t done = 0; done < count; done += RUN_CHUNK)
+			{
+				uint32_t size = (count - done < RUN_CHUNK) ? count - done : RUN_CHUNK;
+
+				if (pServices->Write(Address + done, run, size) != 0U)
+					return APPLET_ERR_FLASH;
+			}
+		}
+
+		Address += count;
+		room -= count;
+		pArgs->Result += count;
+	}
+
+	return APPLET_OK;
+}
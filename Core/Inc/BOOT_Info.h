@@ -80,6 +80,34 @@ const char AUTHOR[] = "Mohammed Khaled \n";
 #define			RD_UNPROTECT_CMD		(uint8_t)(0x0F)
 #define			CRC_CHECK_CMD			(uint8_t)(0x10)
 
+// Pipelined programming
+#define			FLASH_PROG_WIN_CMD		(uint8_t)(0x11)
+#define			FLASH_PROG_EXT_CMD		(uint8_t)(0x12)
+#define			FLASH_PROG_LZ4_CMD		(uint8_t)(0x15)
+#define			FLASH_DELTA_CMD			(uint8_t)(0x16)
+#define			STAGING_CMD				(uint8_t)(0x1C)
+#define			FLASH_WRITE_CMD			(uint8_t)(0x1D)
+#define			AUTO_ERASE_CMD			(uint8_t)(0x19)
+// Link control
+#define			SET_BAUD_CMD			(uint8_t)(0x13)
+// Diagnostics
+#define			STATS_CMD				(uint8_t)(0x14)
+#define			BLOCK_CRC_CMD			(uint8_t)(0x17)
+#define			FLASH_BENCH_CMD			(uint8_t)(0x18)
+#define			BLANK_CHECK_CMD			(uint8_t)(0x1A)
+#define			ERASE_STATUS_CMD		(uint8_t)(0x1B)
+// Boot control
+#define			BOOT_WINDOW_CMD			(uint8_t)(0x1F)
+#define			IMAGE_INFO_CMD			(uint8_t)(0x20)
+#define			SLOT_CMD				(uint8_t)(0x21)
+// Update journal
+#define			JOURNAL_CMD				(uint8_t)(0x22)
+// RAM images
+#define			RAM_WRITE_CMD			(uint8_t)(0x23)
+#define			RAM_EXEC_CMD			(uint8_t)(0x24)
+#define			APPLET_CMD				(uint8_t)(0x25)
+#define			WEAR_CMD				(uint8_t)(0x1E)
+
 
 /**
  * @}
@@ -93,6 +121,7 @@ const char AUTHOR[] = "Mohammed Khaled \n";
 
 #define 		ACK_MSG					(uint8_t)(0x41)
 #define 		NACK_MSG				(uint8_t)(0x4E)
+#define 		PROGRESS_MSG			(uint8_t)(0x50)
 
 
 
@@ -102,6 +131,13 @@ const char AUTHOR[] = "Mohammed Khaled \n";
 #define 		WRPERR_ERR_MSG			(uint8_t)(0xE4)
 #define 		RDPR_ERR_MSG			(uint8_t)(0xE5)
 #define 		OP_ERR_MSG				(uint8_t)(0xE6)
+#define 		DECODE_ERR_MSG			(uint8_t)(0xE7)
+#define 		STAGING_ERR_MSG			(uint8_t)(0xE8)
+#define 		RAM_ERR_MSG				(uint8_t)(0xE9)
+#define 		BAUD_ERR_MSG			(uint8_t)(0xEA)
+#define 		LOCK_ERR_MSG			(uint8_t)(0xEB)
+#define 		RESERVED_ERR_MSG		(uint8_t)(0xEC)
+#define 		RAM_BUSY_ERR_MSG		(uint8_t)(0xED)
 /**
  * @}
  */
@@ -50,8 +50,10 @@ this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #define 	RX_BUFFER_SIZE		64U
 #define 	TX_BUFFER_SIZE		64U
-#define 	PROCESS_NUMBER		17U
-#define 	RX_TIME_OUT			100U
+#define 	RX_PAYLOAD_SIZE		2048U		// largest payload of a variable length frame, multiple of 4.
+#define 	RX_WINDOW_FRAMES	2U			// variable length frames the host keeps in flight (flasher.py EXT_WINDOW_SIZE).
+#define 	STAGING_SIZE		16384U		// RAM staging window, the largest sector fitting in RAM (16 KB).
+#define 	PROCESS_NUMBER		38U
 
 
 /**
@@ -63,9 +65,13 @@ this program.  If not, see <http://www.gnu.org/licenses/>.
  * @{
  */
 extern void (*Process_Handlers[PROCESS_NUMBER])();
+extern uint16_t Process_FrameSize[PROCESS_NUMBER];	// frame length of each command, used by the frame parser.
+extern uint8_t  Process_PayloadLenOffset[PROCESS_NUMBER];	// offset of the 16-bit payload length, zero for fixed frames.
 
 extern uint8_t RxBuffer[RX_BUFFER_SIZE];		// this buffer will contain the proceed data for all process functions.
 extern uint8_t TxBuffer[TX_BUFFER_SIZE];		// this buffer will contain the proceed data for all process functions.
+extern uint8_t *RxPayload;						// payload bank filled by the frame parser, word aligned.
+extern uint16_t RxPayloadLen;					// payload length announced by the last variable length frame.
 
 /**
  * @}
@@ -113,9 +119,59 @@ void PROCESS_FLASH_READ_CMD				(void);
 void PROCESS_FLASH_ERASE_CMD			(void);
 void PROCESS_FLASH_MASS_ERASE_CMD	    (void);
 void PROCESS_FLASH_CPY_CMD				(void);
+void PROCESS_FLASH_PROG_WIN_CMD			(void);
+void PROCESS_FLASH_PROG_EXT_CMD			(void);
+
+void PROCESS_FLASH_PROG_LZ4_CMD			(void);
+
+void PROCESS_FLASH_DELTA_CMD				(void);
+
+void PROCESS_STAGING_CMD					(void);
+
+void PROCESS_FLASH_WRITE_CMD				(void);
 
 void PROCESS_TRANSFER_CNTRL_CMD			(void);
 
+void PROCESS_SET_BAUD_CMD				(void);
+
+void PROCESS_STATS_CMD					(void);
+
+void PROCESS_BLOCK_CRC_CMD				(void);
+
+void PROCESS_CRC_CHECK_CMD				(void);
+
+void PROCESS_FLASH_BENCH_CMD				(void);
+
+void PROCESS_STAGE_RUN					(void);
+
+void PROCESS_STAGE_WAIT					(void);
+
+void PROCESS_AUTO_ERASE_CMD				(void);
+
+void PROCESS_BLANK_CHECK_CMD				(void);
+
+void PROCESS_ERASE_STATUS_CMD				(void);
+
+void PROCESS_WEAR_CMD						(void);
+
+void PROCESS_BOOT_WINDOW_CMD				(void);
+
+void PROCESS_IMAGE_INFO_CMD				(void);
+
+void PROCESS_SLOT_CMD						(void);
+
+void PROCESS_JOURNAL_CMD					(void);
+
+void PROCESS_RAM_WRITE_CMD					(void);
+
+void PROCESS_RAM_EXEC_CMD					(void);
+
+void PROCESS_APPLET_CMD					(void);
+
+void PROCESS_READY						(void);
+
+void PROCESS_BACKGROUND					(void);
+
 
 
 /**
@@ -153,7 +209,6 @@ void PROCESS_INIT						(void);
 // FOR FUTURE VERSION
 void PROCESS_RD_PROTECT_CMD				(void);
 void PROCESS_RD_UNPROTECT_CMD			(void);
-void PROCESS_CRC_CHECK_CMD				(void);
 
 
 /**
@@ -0,0 +1,137 @@
+/*******************************************************************************
+ * @file    boot_applet.h
+ * @author  Mohammed Khaled
+ * @email   Mohammed.kh384@gmail.com
+ * @website EMSTutorials.blogspot.com/
+ * @Created on: Apr 12, 2023
+ *
+ * @brief   this header file contains the ABI of the flash applets.
+ * @note	An applet is a small position independent routine loaded by the host into
+ * 			the RAM area (RAM_WRITE_CMD) and called by APPLET_CMD with buffer descriptors.
+ * 			It starts with an APPLET_HeaderType, its entry gets the arguments and the
+ * 			services of the bootloader (flash engine, CRC) and returns a status, zero
+ * 			when it succeeded. The applet runs on the stack of the bootloader with the
+ * 			interrupts enabled, it must not use writable static data.
+ * 			Only standard types are used, the applets include this header as it is
+ * 			(see Applets/).
+ *
+@verbatim
+Copyright (C) EMSTutorials, 2019
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+@endverbatim
+*******************************************************************************/
+
+
+#ifndef INC_BOOT_APPLET_H_
+#define INC_BOOT_APPLET_H_
+
+
+/*
+ * Includes:
+ */
+#include <stdint.h>
+
+
+
+/**
+ * @addtogroup APPLET
+ * @{
+ */
+
+/**
+ * @defgroup APPLET_Exported_Macros
+ * @{
+ */
+
+#define 	APPLET_MAGIC			0x544C5041U		// "APLT"
+#define 	APPLET_ABI_VERSION		1U				// changes with the layout of the ABI types.
+#define 	APPLET_STACK_MAX		256U			// bytes of stack an applet may use.
+
+// Status returned by an applet, the applets may define their own from APPLET_STATUS_USER on.
+#define 	APPLET_OK				0x00U
+#define 	APPLET_ERR_ARGS			0x01U			// buffers or parameter refused.
+#define 	APPLET_ERR_FLASH		0x02U			// a flash service failed.
+#define 	APPLET_ERR_DATA			0x03U			// malformed source data.
+#define 	APPLET_STATUS_USER		0x80U
+
+/**
+ * @}
+ */
+
+
+/**
+ * @defgroup APPLET_Exported_Types
+ * @{
+ */
+
+// Applet image header, at the load address (word aligned).
+typedef struct {
+	uint32_t	Magic;			// APPLET_MAGIC.
+	uint32_t	Version;		// APPLET_ABI_VERSION the applet was built for.
+	uint32_t	Size;			// bytes of the applet, header included.
+	uint32_t	Entry;			// offset of the entry from the header, thumb bit set.
+} APPLET_HeaderType;
+
+// Memory buffer given to an applet, flash or SRAM.
+typedef struct {
+	uint32_t	Address;
+	uint32_t	Size;			// bytes.
+} APPLET_BufferType;
+
+// Services of the bootloader, the flash must be unlocked by the host (program session).
+// The functions return zero when they succeeded.
+typedef struct {
+	uint32_t	Version;		// APPLET_ABI_VERSION.
+	uint32_t	(*Prepare)(uint32_t Address, uint32_t size);						// erase ahead of programming (auto erase).
+	uint32_t	(*Program)(uint32_t Address, const uint8_t *pData, uint32_t size);	// word aligned, blank words skipped.
+	uint32_t	(*Write)(uint32_t Address, const uint8_t *pData, uint32_t size);	// any range, coalesced into words.
+	uint32_t	(*Crc)(uint32_t Address, uint32_t size);							// CRC32_Compute, not a status.
+} APPLET_ServicesType;
+
+// Arguments of an applet call.
+typedef struct {
+	uint32_t					Param;		// applet defined.
+	APPLET_BufferType			Src;		// input buffer.
+	APPLET_BufferType			Dst;		// output buffer.
+	uint32_t					Result;		// applet defined, sent back to the host (bytes written, ...).
+	const APPLET_ServicesType	*pServices;
+} APPLET_ArgsType;
+
+/*Entry of an applet, returns APPLET_OK or an error status.*/
+typedef uint32_t (*APPLET_EntryType)(APPLET_ArgsType *pArgs);
+
+/**
+ * @}
+ */
+
+
+/**
+ * @defgroup APPLET_Exported_Functions
+ * @{
+ */
+
+	/*Check the header of an applet loaded in the RAM area, 1 when it can be called.*/
+	uint8_t APPLET_Valid(uint32_t Address);
+
+	/*Call the applet at Address, the coalesced writes it left are flushed. Returns its status.*/
+	uint32_t APPLET_Run(uint32_t Address, APPLET_ArgsType *pArgs);
+
+/**
+ * @}
+ */
+
+/**
+ * @}
+ */
+
+#endif /* INC_BOOT_APPLET_H_ */
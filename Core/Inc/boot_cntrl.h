@@ -102,6 +102,38 @@ this program.  If not, see <http://www.gnu.org/licenses/>.
  * @{
  */
 
+#define 	BOOT_SLOTS				2U				// application slots, each starts with an image header.
+#define 	BOOT_SLOT_A_ADDRESS		0x08010000U		// sector 4 (64 KB), after the metadata sector.
+#define 	BOOT_SLOT_B_ADDRESS		0x08020000U		// sector 5 (128 KB).
+#define 	BOOT_SLOT_NONE			0xFFU
+#define 	BOOT_SLOT_AUTO			0xFFFFFFFFU		// transfer address selecting the slot to boot.
+#define 	BOOT_TRIAL_MAX			3U				// boots of a pending slot without confirmation before it fails, boots after a power loss aside.
+#define 	BOOT_HEADER_MAGIC		0x474D4942U		// "BIMG"
+#define 	BOOT_HEADER_SIZE		0x00000200U		// header area, the image (vector table) follows it aligned for VTOR.
+#define 	BOOT_WINDOW_DEFAULT		5U				// ms of host activity window before the auto-boot.
+#define 	BOOT_WINDOW_MAX			10000U			// ms, longest window accepted.
+#define 	BOOT_WINDOW_OFF			0xFFFFU			// window value that disables the auto-boot.
+#define 	BOOT_KEY_WINDOW			0x00U			// META_TAG_BOOT key of the window setting.
+#define 	BOOT_VECTOR_ALIGN		0x00000200U		// VTOR alignment of a vector table (101 vectors).
+#define 	BOOT_RAM_AREA_DATA		__attribute__((section(".ram_area")))	// bootloader buffer overlaid by the RAM area.
+
+// Requests to stay in the bootloader, checked by BOOT_EARLY_DECISION.
+#define 	BOOT_REQUEST_MAGIC		0x424F4F54U		// written in RTC->BKP3R by the application before a reset.
+#define 	BOOT_CONFIRM_MAGIC		0x434F4E46U		// written in RTC->BKP5R by a trial image once it runs fine, then a reset records it.
+#define 	BOOT_REQUEST_PIN		0U				// PA0 (KEY button), held low at reset.
+#define 	BOOT_RX_PIN				10U				// PA10 (USART1 RX), a start bit is host traffic.
+
+// Image states of BOOT_IMAGE_STATE.
+#define 	BOOT_IMAGE_NONE			0x00U			// no valid header.
+#define 	BOOT_IMAGE_UNVERIFIED	0x01U			// valid header, CRC not checked since the image changed.
+#define 	BOOT_IMAGE_VERIFIED		0x02U			// CRC checked, the validated marker matches the header.
+
+// Slot states.
+#define 	BOOT_SLOT_EMPTY			0x00U			// no image recorded.
+#define 	BOOT_SLOT_PENDING		0x01U			// new image, trial-booted until confirmed or failed.
+#define 	BOOT_SLOT_CONFIRMED		0x02U			// image confirmed, the newest one boots.
+#define 	BOOT_SLOT_FAILED		0x03U			// not confirmed within BOOT_TRIAL_MAX boots.
+
 /**
  * @}
  */
@@ -112,6 +144,35 @@ this program.  If not, see <http://www.gnu.org/licenses/>.
 
 typedef uint32_t FLASH_ErrorCode;
 
+/*Progress of a long operation, called with the number of bytes done.*/
+typedef void (*BOOT_ProgressType)(uint32_t done);
+
+// Image header, at the start of the image area (BOOT_HEADER_SIZE bytes, the rest erased).
+typedef struct {
+	uint32_t	Magic;			// BOOT_HEADER_MAGIC.
+	uint32_t	Version;
+	uint32_t	LoadAddress;	// first byte of the image, header address + BOOT_HEADER_SIZE.
+	uint32_t	Length;			// bytes of the image, multiple of 4.
+	uint32_t	Entry;			// vector table of the image, inside it.
+	uint32_t	Crc;			// CRC32_Compute(LoadAddress, Length).
+} BOOT_HeaderType;
+
+// State of a slot, kept in the metadata log.
+typedef struct {
+	uint8_t		State;			// BOOT_SLOT_*.
+	uint8_t		Tries;			// trial boots of a pending image.
+	uint32_t	Sequence;		// order of the images, the newest is the highest.
+	uint32_t	Crc;			// header CRC of the image the state belongs to.
+} BOOT_SlotType;
+
+// Boot latency, measured from Reset_Handler with the DWT cycle counter.
+typedef struct {
+	uint32_t	LastBoot;		// us, reset to the jump of the last auto-boot, zero when unknown.
+	uint32_t	LastDecision;	// us, reset to the start of its host activity window.
+	uint32_t	Window;			// ms, host activity window in use, BOOT_WINDOW_OFF when disabled.
+	uint32_t	Ready;			// us, reset to the command loop of this boot.
+} BOOT_LatencyType;
+
 /**
  * @}
  */
@@ -133,8 +194,66 @@ typedef uint32_t FLASH_ErrorCode;
  	/*This function shouldn't return, if returned the transfer control has failed*/
 	void BOOT_TRANSFER_CNTRL(uint32_t ImageAddress);
 
-	/*Copy Image from Source location to destination location.*/
-	HAL_StatusTypeDef BOOT_CPY_IMAGE(uint32_t srcAddress ,uint32_t destAddress, uint32_t size);
+	/*Copy Image from Source location to destination location, erasing the destination sectors as needed.*/
+	HAL_StatusTypeDef BOOT_CPY_IMAGE(uint32_t srcAddress ,uint32_t destAddress, uint32_t size,
+									 uint32_t *pCrc, BOOT_ProgressType Progress);
+
+	/*Boot decision called by Reset_Handler before main, jumps to the application when the bootloader isn't needed.*/
+	void BOOT_EARLY_DECISION(void);
+
+	/*Check the vector table of an image in flash : stack pointer in SRAM, reset handler in the image.*/
+	uint8_t BOOT_IMAGE_VALID(uint32_t ImageAddress);
+
+	/*SRAM where the RAM images are loaded, fixed (upper 32K) : [*pStart, *pEnd).*/
+	void BOOT_RAM_AREA(uint32_t *pStart, uint32_t *pEnd);
+
+	/*Check the vector table of an image loaded in the RAM area, aligned for VTOR.*/
+	uint8_t BOOT_RAM_IMAGE_VALID(uint32_t ImageAddress);
+
+	/*Check the fields of an image header, the image itself isn't read.*/
+	uint8_t BOOT_HEADER_VALID(uint32_t HeaderAddress);
+
+	/*State of the image of a header, O(1) : no CRC computed.*/
+	uint8_t BOOT_IMAGE_STATE(uint32_t HeaderAddress);
+
+	/*Check the CRC of the image of a header and record the validated marker, HAL_ERROR when invalid.*/
+	HAL_StatusTypeDef BOOT_IMAGE_VERIFY(uint32_t HeaderAddress);
+
+	/*Drop the validated marker of an image about to change.*/
+	void BOOT_IMAGE_INVALIDATE(uint32_t HeaderAddress);
+
+	/*Header address of a slot, zero for an unknown slot.*/
+	uint32_t BOOT_SLOT_ADDRESS(uint8_t slot);
+
+	/*State of a slot, BOOT_SLOT_EMPTY when none was recorded.*/
+	void BOOT_GET_SLOT(uint8_t slot, BOOT_SlotType *pSlot);
+
+	/*Verify the slots, a new image becomes pending.*/
+	void BOOT_SLOTS_UPDATE(void);
+
+	/*Slot to boot : a pending trial newer than the newest confirmed slot, or that slot. Counts the trials.*/
+	uint8_t BOOT_SELECT_SLOT(void);
+
+	/*Confirm the image of a slot and make it the newest, the atomic switch to that slot.*/
+	HAL_StatusTypeDef BOOT_CONFIRM_SLOT(uint8_t slot);
+
+	/*Mark the switch of the system clock to the PLL, call right after SystemClock_Config.*/
+	void BOOT_MARK_CLOCK(void);
+
+	/*Microseconds elapsed since Reset_Handler.*/
+	uint32_t BOOT_RESET_TIME(void);
+
+	/*Host activity window of the auto-boot (ms), BOOT_WINDOW_DEFAULT unless set.*/
+	uint32_t BOOT_GET_WINDOW(void);
+
+	/*Keep a new host activity window in the metadata log.*/
+	HAL_StatusTypeDef BOOT_SET_WINDOW(uint32_t window);
+
+	/*Keep the latency of an auto-boot in the backup registers, it survives the jump and resets.*/
+	void BOOT_SAVE_LATENCY(uint32_t decision, uint32_t boot);
+
+	/*Latency of the last auto-boot, zero when none was kept.*/
+	void BOOT_GET_LATENCY(BOOT_LatencyType *pLatency);
 
 
 
@@ -0,0 +1,87 @@
+/*******************************************************************************
+ * @file    boot_comm.h
+ * @author  Mohammed Khaled
+ * @email   Mohammed.kh384@gmail.com
+ * @website EMSTutorials.blogspot.com/
+ * @Created on: Mar 12, 2023
+ *
+ * @brief   this header file contains the declarations of the host communication APIs.
+ * @note	USART1 reception runs continuously on a DMA2 circular ring, the frame
+ * 			parser drains the ring and rebuilds one command frame at a time.
+ *
+@verbatim
+Copyright (C) EMSTutorials, 2019
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+@endverbatim
+*******************************************************************************/
+
+
+#ifndef INC_BOOT_COMM_H_
+#define INC_BOOT_COMM_H_
+
+
+/*
+ * Includes:
+ */
+#include "stm32f4xx_hal.h"
+
+
+
+/**
+ * @addtogroup COMM
+ * @{
+ */
+
+/**
+ * @defgroup COMM_Exported_Macros
+ * @{
+ */
+
+#define 	COMM_RING_SIZE			8192U		// DMA circular ring size, power of two above the frames the host keeps in flight.
+#define 	COMM_FRAME_TIMEOUT		5U			// ms of silent line before a partial frame is dropped.
+#define 	COMM_BAUD_MAX_ERROR		3U			// Max deviation of the generated baud rate in percent.
+
+/**
+ * @}
+ */
+
+
+/**
+ * @defgroup COMM_Exported_Functions
+ * @{
+ */
+
+	/*Start the circular DMA reception on USART1.*/
+	void COMM_Init(void);
+
+	/*Drain the ring, returns the frame length once a complete frame is in RxBuffer, zero otherwise.*/
+	uint32_t COMM_GetFrame(void);
+
+	/*Number of received bytes not parsed yet.*/
+	uint32_t COMM_Pending(void);
+
+	/*Check that USART1 can generate the baud rate from PCLK2 (8x oversampling above PCLK2/16).*/
+	HAL_StatusTypeDef COMM_CheckBaudRate(uint32_t baudRate);
+
+	/*Reconfigure USART1 to a new baud rate and restart the reception, pending bytes are dropped.*/
+	HAL_StatusTypeDef COMM_SetBaudRate(uint32_t baudRate);
+
+/**
+ * @}
+ */
+
+/**
+ * @}
+ */
+
+#endif /* INC_BOOT_COMM_H_ */
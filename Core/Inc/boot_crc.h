@@ -0,0 +1,64 @@
+/*******************************************************************************
+ * @file    boot_crc.h
+ * @author  Mohammed Khaled
+ * @email   Mohammed.kh384@gmail.com
+ * @website EMSTutorials.blogspot.com/
+ * @Created on: Mar 24, 2023
+ *
+ * @brief   this header file contains the declarations of the flash CRC APIs.
+ * @note	The CRC is the one of the STM32 CRC unit : CRC-32 polynomial 0x04C11DB7,
+ * 			initial value 0xFFFFFFFF, fed by 32-bit words, no reflection, no final XOR.
+ *
+@verbatim
+Copyright (C) EMSTutorials, 2019
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+@endverbatim
+*******************************************************************************/
+
+
+#ifndef INC_BOOT_CRC_H_
+#define INC_BOOT_CRC_H_
+
+
+/*
+ * Includes:
+ */
+#include "stm32f4xx_hal.h"
+
+
+
+/**
+ * @addtogroup CRC32
+ * @{
+ */
+
+/**
+ * @defgroup CRC32_Exported_Functions
+ * @{
+ */
+
+	/*Enable the CRC unit clock.*/
+	void CRC32_Init(void);
+
+	/*CRC of a word aligned memory area, size is a multiple of 4 bytes.*/
+	uint32_t CRC32_Compute(uint32_t Address, uint32_t size);
+
+/**
+ * @}
+ */
+
+/**
+ * @}
+ */
+
+#endif /* INC_BOOT_CRC_H_ */
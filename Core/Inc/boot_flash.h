@@ -0,0 +1,148 @@
+/*******************************************************************************
+ * @file    boot_flash.h
+ * @author  Mohammed Khaled
+ * @email   Mohammed.kh384@gmail.com
+ * @website EMSTutorials.blogspot.com/
+ * @Created on: Mar 28, 2023
+ *
+ * @brief   this header file contains the declarations of the flash programming engine.
+ * @note	The engine drives FLASH->CR/SR directly from RAM (.RamFunc), errors are
+ * 			reported through HAL_FLASH_GetError() like the HAL flash driver does.
+ * 			With auto erase, a program session erases every sector on its first write
+ * 			and erases the next sector in the background while the link is idle.
+ * 			Sectors already blank are never erased again.
+ * 			BFLASH_Write accepts any address and length, contiguous writes are coalesced
+ * 			into words, only the head and tail fragments use byte or halfword programs.
+ *
+@verbatim
+Copyright (C) EMSTutorials, 2019
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+@endverbatim
+*******************************************************************************/
+
+
+#ifndef INC_BOOT_FLASH_H_
+#define INC_BOOT_FLASH_H_
+
+
+/*
+ * Includes:
+ */
+#include "stm32f4xx_hal.h"
+
+
+
+/**
+ * @addtogroup BFLASH
+ * @{
+ */
+
+/**
+ * @defgroup BFLASH_Exported_Macros
+ * @{
+ */
+
+#define 	BFLASH_NO_SECTOR		0xFFU
+#define 	BFLASH_COALESCE_SIZE	256U		// write coalescing buffer, multiple of 4.
+
+/**
+ * @}
+ */
+
+
+/**
+ * @defgroup BFLASH_Exported_Types
+ * @{
+ */
+
+// Write coalescing statistics, accumulated since the start of the program session.
+typedef struct {
+	uint32_t	Writes;			// BFLASH_Write calls.
+	uint32_t	Bytes;			// bytes written.
+	uint32_t	WordOps;		// words programmed.
+	uint32_t	FragmentOps;	// byte and halfword programs of the head and tail fragments.
+} BFLASH_WriteStatsType;
+
+/**
+ * @}
+ */
+
+
+/**
+ * @defgroup BFLASH_Exported_Functions
+ * @{
+ */
+
+	/*Program a word aligned area from a buffer, 0xFFFFFFFF words and words already identical are skipped.*/
+	HAL_StatusTypeDef BFLASH_Program(uint32_t Address, const uint8_t *pData, uint32_t size);
+
+	/*First word not erased in [Address, Address + size), Address + size when the area is blank.*/
+	uint32_t BFLASH_BlankCheck(uint32_t Address, uint32_t size);
+
+	/*1 when every word of the sector is erased.*/
+	uint8_t BFLASH_SectorBlank(uint8_t sector);
+
+	/*1 for the sectors the erase and program commands never touch : bootloader and metadata log.*/
+	uint8_t BFLASH_IsReserved(uint8_t sector);
+
+	/*Erase the sectors not blank, SectorError is 0xFFFFFFFF or the failing sector as HAL_FLASHEx_Erase.*/
+	HAL_StatusTypeDef BFLASH_EraseSectors(uint32_t sector, uint32_t nbSectors, uint32_t *SectorError);
+
+	/*Sector holding an address, BFLASH_NO_SECTOR outside of the flash.*/
+	uint8_t BFLASH_SectorOf(uint32_t Address);
+
+	/*Bytes from an address to the end of its sector, 0 outside of the flash.*/
+	uint32_t BFLASH_SectorRemaining(uint32_t Address);
+
+	/*Start a program session, no sector is known as erased, sectors from limit on are never erased ahead.*/
+	void BFLASH_SessionStart(uint8_t autoErase, uint32_t limit);
+
+	/*Record sectors erased by an erase command.*/
+	void BFLASH_MarkErased(uint32_t sector, uint32_t nbSectors);
+
+	/*Erase the sectors of an area not erased yet in the session (auto erase only), call before programming.*/
+	HAL_StatusTypeDef BFLASH_Prepare(uint32_t Address, uint32_t size);
+
+	/*Erase the sectors of an area that can't take the data as they are (whatever the auto erase).*/
+	HAL_StatusTypeDef BFLASH_PrepareCopy(uint32_t Address, const uint8_t *pData, uint32_t size);
+
+	/*Erase the sectors of an area not erased yet in the session (whatever the auto erase) and program it.*/
+	HAL_StatusTypeDef BFLASH_Commit(uint32_t Address, const uint8_t *pData, uint32_t size);
+
+	/*Write any byte range, adjacent writes are merged into words and programmed lazily.*/
+	HAL_StatusTypeDef BFLASH_Write(uint32_t Address, const uint8_t *pData, uint32_t size);
+
+	/*Program the bytes still held by the write coalescing buffer.*/
+	HAL_StatusTypeDef BFLASH_Flush(void);
+
+	/*Write coalescing statistics of the program session.*/
+	const BFLASH_WriteStatsType *BFLASH_WriteStats(void);
+
+	/*Complete the background erase once the flash is done, call from the main loop.*/
+	void BFLASH_Poll(void);
+
+	/*Wait for the background erase, the flash can't be used before.*/
+	void BFLASH_Wait(void);
+
+	/*Start the background erase of the next sector, call only while nothing is being programmed.*/
+	void BFLASH_Lookahead(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @}
+ */
+
+#endif /* INC_BOOT_FLASH_H_ */
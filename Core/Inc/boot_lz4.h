@@ -0,0 +1,73 @@
+/*******************************************************************************
+ * @file    boot_lz4.h
+ * @author  Mohammed Khaled
+ * @email   Mohammed.kh384@gmail.com
+ * @website EMSTutorials.blogspot.com/
+ * @Created on: Mar 19, 2023
+ *
+ * @brief   this header file contains the declarations of the LZ4 block decoder.
+ * @note	Compressed program frames carry one independent LZ4 block (no frame
+ * 			header, no dictionary), decoded into a bounded RAM window before programming.
+ *
+@verbatim
+Copyright (C) EMSTutorials, 2019
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+@endverbatim
+*******************************************************************************/
+
+
+#ifndef INC_BOOT_LZ4_H_
+#define INC_BOOT_LZ4_H_
+
+
+/*
+ * Includes:
+ */
+#include <stdint.h>
+
+
+
+/**
+ * @addtogroup LZ4
+ * @{
+ */
+
+/**
+ * @defgroup LZ4_Exported_Macros
+ * @{
+ */
+
+#define 	LZ4_RAW_SIZE			4096U		// decoded size of a compressed frame at most, multiple of 4.
+
+/**
+ * @}
+ */
+
+
+/**
+ * @defgroup LZ4_Exported_Functions
+ * @{
+ */
+
+	/*Decode one LZ4 block, returns the decoded length or -1 if the block is corrupted or doesn't fit.*/
+	int32_t LZ4_DecodeBlock(const uint8_t *pSrc, uint32_t srcLen, uint8_t *pDst, uint32_t dstCap);
+
+/**
+ * @}
+ */
+
+/**
+ * @}
+ */
+
+#endif /* INC_BOOT_LZ4_H_ */
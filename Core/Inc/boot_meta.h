@@ -0,0 +1,118 @@
+/*******************************************************************************
+ * @file    boot_meta.h
+ * @author  Mohammed Khaled
+ * @email   Mohammed.kh384@gmail.com
+ * @website EMSTutorials.blogspot.com/
+ * @Created on: Apr 4, 2023
+ *
+ * @brief   this header file contains the declarations of the bootloader metadata log.
+ * @note	The metadata sector holds a log of fixed size records, appended one after the
+ * 			other and compacted (latest record of every tag and key kept) when full.
+ * 			It keeps the erase count, the last erase sequence and the erase times of
+ * 			every sector (flash wear telemetry).
+ *
+@verbatim
+Copyright (C) EMSTutorials, 2019
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+@endverbatim
+*******************************************************************************/
+
+
+#ifndef INC_BOOT_META_H_
+#define INC_BOOT_META_H_
+
+
+/*
+ * Includes:
+ */
+#include "stm32f4xx_hal.h"
+
+
+
+/**
+ * @addtogroup META
+ * @{
+ */
+
+/**
+ * @defgroup META_Exported_Macros
+ * @{
+ */
+
+#define 	META_SECTOR				FLASH_SECTOR_3	// reserved to the metadata, never erased by the program paths.
+#define 	META_ADDRESS			0x0800C000U
+#define 	META_SIZE				0x00004000U
+#define 	META_RECORD_SIZE		16U				// [DATA 0][DATA 1][DATA 2][HEADER], header written last.
+#define 	META_DATA_WORDS			3U
+#define 	META_KEEP_MAX			64U				// records kept by a compaction, and indexed.
+#define 	META_SAVE_MAX			3U				// slot and boot records kept in the backup registers meanwhile.
+
+// Record tags.
+#define 	META_TAG_WEAR			0x01U			// key : sector, data : WEAR record.
+#define 	META_TAG_BOOT			0x02U			// key : BOOT_KEY_*, data : boot settings.
+#define 	META_TAG_IMAGE			0x03U			// key : header address / 4 KB, data : validated marker.
+#define 	META_TAG_SLOT			0x04U			// key : slot, data : slot state.
+#define 	META_TAG_JOURNAL		0x05U			// key : JOURNAL_KEY_*, data : update journal.
+
+/**
+ * @}
+ */
+
+
+/**
+ * @defgroup META_Exported_Types
+ * @{
+ */
+
+// Wear of a sector, kept in its WEAR record.
+typedef struct {
+	uint32_t	Count;			// erases since the log started.
+	uint32_t	Sequence;		// erase sequence number of the last erase (orders the erases of all sectors).
+	uint16_t	LastTime;		// ms, last erase.
+	uint16_t	FirstTime;		// ms, first erase recorded (reference of a new sector).
+} META_WearType;
+
+/**
+ * @}
+ */
+
+
+/**
+ * @defgroup META_Exported_Functions
+ * @{
+ */
+
+	/*Find the end of the log and index its latest records, call once at start up.*/
+	void META_Init(void);
+
+	/*Data of the latest record of a tag and key from the index, HAL_ERROR when there is none.*/
+	HAL_StatusTypeDef META_Read(uint8_t tag, uint8_t key, uint32_t *pData);
+
+	/*Append a record, the log is compacted first when full. Unlocks the flash when needed.*/
+	HAL_StatusTypeDef META_Write(uint8_t tag, uint8_t key, const uint32_t *pData);
+
+	/*Account an erase of a sector that took durationUs.*/
+	void META_RecordErase(uint8_t sector, uint32_t durationUs);
+
+	/*Wear of a sector, zero when never erased since the log started.*/
+	void META_GetWear(uint8_t sector, META_WearType *pWear);
+
+/**
+ * @}
+ */
+
+/**
+ * @}
+ */
+
+#endif /* INC_BOOT_META_H_ */
@@ -0,0 +1,154 @@
+/*******************************************************************************
+ * @file    boot_applet.c
+ * @author  Mohammed Khaled
+ * @email   Mohammed.kh384@gmail.com
+ * @website EMSTutorials.blogspot.com/
+ * @Created on: Apr 12, 2023
+ *
+ * @brief   this source file contains the implementation of the flash applets calls.
+ * @note	The services handed to the applets wrap the flash engine and the CRC unit,
+ * 			so an applet programs through the session of the host (auto erase, erased
+ * 			sectors) like the program commands do.
+ *
+@verbatim
+Copyright (C) EMSTutorials, 2019
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+@endverbatim
+*******************************************************************************/
+
+/**************** Includes ********************/
+#include "boot_applet.h"
+#include "boot_cntrl.h"
+#include "boot_flash.h"
+#include "boot_crc.h"
+
+
+/**
+ * @defgroup  private local functions
+ * @brief
+ * @{
+ */
+
+static uint32_t APPLET_PREPARE(uint32_t Address, uint32_t size);
+static uint32_t APPLET_PROGRAM(uint32_t Address, const uint8_t *pData, uint32_t size);
+static uint32_t APPLET_WRITE(uint32_t Address, const uint8_t *pData, uint32_t size);
+
+/**
+  * @}
+  */
+
+
+/**
+ * @defgroup  private local variables
+ * @brief
+ * @{
+ */
+
+static const APPLET_ServicesType Services = {
+		APPLET_ABI_VERSION,
+		APPLET_PREPARE,
+		APPLET_PROGRAM,
+		APPLET_WRITE,
+		CRC32_Compute };
+
+/**
+  * @}
+  */
+
+
+/**
+ * @brief	Check the header of an applet loaded in the RAM area
+ * @note	The whole applet must be inside the area (BOOT_RAM_AREA) and built for this
+ * 			ABI version, its entry a thumb address inside it, after the header.
+ * @param   Address: applet header address (word aligned)
+ * @retval  1 when the applet can be called
+ */
+uint8_t APPLET_Valid(uint32_t Address){
+
+	uint32_t start, end;
+	const APPLET_HeaderType *pHeader = (const APPLET_HeaderType*) Address;
+
+	BOOT_RAM_AREA(&start, &end);
+
+	if (Address < start || Address > end - sizeof(APPLET_HeaderType) || (Address & 0x3U) != 0U)
+		return 0;
+
+	if (pHeader->Magic != APPLET_MAGIC || pHeader->Version != APPLET_ABI_VERSION
+		|| pHeader->Size < sizeof(APPLET_HeaderType) || pHeader->Size > end - Address)
+		return 0;
+
+	if ((pHeader->Entry & 0x1U) == 0U || pHeader->Entry < sizeof(APPLET_HeaderType) || pHeader->Entry >= pHeader->Size)
+		return 0;
+
+	return 1;
+}
+
+
+/**
+ * @}
+ */
+
+
+/**
+ * @brief	Call an applet
+ * @note	The applet gets the services of the bootloader through pArgs. The writes it
+ * 			left in the coalescing buffer are flushed, a failed flush is reported as
+ * 			APPLET_ERR_FLASH.
+ * @param   Address: applet header address (APPLET_Valid), pArgs: arguments, Result updated
+ * @retval  status of the applet
+ */
+uint32_t APPLET_Run(uint32_t Address, APPLET_ArgsType *pArgs){
+
+	APPLET_EntryType Entry = (APPLET_EntryType)(Address + ((const APPLET_HeaderType*) Address)->Entry);
+
+	pArgs->Result = 0;
+	pArgs->pServices = &Services;
+
+	uint32_t status = Entry(pArgs);
+
+	if (BFLASH_Flush() != HAL_OK && status == APPLET_OK)
+		status = APPLET_ERR_FLASH;
+
+	return status;
+}
+
+
+/**
+ * @}
+ */
+
+
+/**
+ * @brief	Services of the applets, the flash engine returning zero when it succeeded
+ * @param   Address: flash address, pData: data, size: number of bytes
+ * @retval  HAL_StatusTypeDef as uint32_t
+ */
+static uint32_t APPLET_PREPARE(uint32_t Address, uint32_t size){
+
+	return BFLASH_Prepare(Address, size);
+}
+
+static uint32_t APPLET_PROGRAM(uint32_t Address, const uint8_t *pData, uint32_t size){
+
+	return BFLASH_Program(Address, pData, size);
+}
+
+static uint32_t APPLET_WRITE(uint32_t Address, const uint8_t *pData, uint32_t size){
+
+	return BFLASH_Write(Address, pData, size);
+}
+
+
+/**
+ * @}
+ */
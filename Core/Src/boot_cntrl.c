@@ -27,6 +27,9 @@ this program.  If not, see <http://www.gnu.org/licenses/>.
 
 /**************** Includes ********************/
 #include "BOOT_CNTRL.h"
+#include "boot_flash.h"
+#include "boot_crc.h"
+#include "boot_meta.h"
 
 
 
@@ -41,6 +44,13 @@ this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
 static void BOOT_SYS_RESET(void);
+static uint8_t BOOT_HOST_REQUEST(uint32_t windowCycles);
+static uint32_t BOOT_HEADER_FOLD(const BOOT_HeaderType *pHeader);
+static void BOOT_BKP_WRITE(__IO uint32_t *pRegister, uint32_t value);
+static uint8_t BOOT_SLOT_IMAGE(uint8_t slot);
+static HAL_StatusTypeDef BOOT_SET_SLOT(uint8_t slot, const BOOT_SlotType *pSlot);
+static uint32_t BOOT_NEXT_SEQUENCE(void);
+static void BOOT_APPLY_CONFIRM(void);
 
 /**
  * @defgroup Exported_VALUES (MEM_MAP_ADDRESSES)
@@ -49,6 +59,26 @@ static void BOOT_SYS_RESET(void);
 #define 	FLASH_MEM_ADDR		(uint32_t)(0x08000000)
 #define 	SYS_MEM_ADDR	(uint32_t)(0x1FFF0000)
 #define 	RAM_ADDR		(uint32_t)(0x20000000)
+#define 	RAM_SIZE		(uint32_t)(0x00010000)
+
+#define 	CPY_CHUNK_SIZE	(uint32_t)(0x00001000)		// bytes programmed between two progress calls.
+
+// Backup registers keeping the latency of the last auto-boot, the check is the complement of the boot time.
+#define 	BKP_BOOT		(RTC->BKP0R)
+#define 	BKP_DECISION	(RTC->BKP1R)
+#define 	BKP_CHECK		(RTC->BKP2R)
+#define 	BKP_REQUEST		(RTC->BKP3R)
+#define 	BKP_TRIAL		(RTC->BKP4R)		// slot + 1 of the running trial image, zero when none.
+#define 	BKP_CONFIRM		(RTC->BKP5R)
+// BKP6R to BKP18R save the slot and boot records during a compaction of the metadata log.
+
+#define 	PIN_SETTLE_CYCLES	(uint32_t)(160)		// pull-ups settling before the first read (10 us on the HSI).
+
+// Validated marker : META_TAG_IMAGE record [CRC][LENGTH][HEADER FOLD] of the header, all zero once dropped.
+#define 	MARKER_KEY(addr)	(uint8_t)(((addr) - FLASH_MEM_ADDR) >> 12U)
+
+// Slot state : META_TAG_SLOT record [STATE | TRIES << 8][SEQUENCE][IMAGE CRC].
+#define 	SLOT_TRIES_SHIFT	(8U)
 
 
 /**
@@ -71,6 +101,24 @@ typedef	  uint32_t	SizeType;
   */
 
 
+/**
+ * @defgroup  private local variables
+ * @brief
+ * @{
+ */
+
+static uint32_t ClockCycle;			// DWT cycles run on the HSI, before the switch to the PLL.
+
+extern uint32_t _sramload, _eramload;		// RAM area of the RAM images, see the linker script.
+
+static const AddressType SlotAddress[BOOT_SLOTS] = { BOOT_SLOT_A_ADDRESS, BOOT_SLOT_B_ADDRESS };
+static const SizeType SlotSize[BOOT_SLOTS] = { 0x00010000U, 0x00020000U };
+
+/**
+  * @}
+  */
+
+
 /**
  * @brief 	Jump and transfer control into a program image at a specific location
  * @note	The function shouldn't return, if returned, an error has occurred.
@@ -86,7 +134,7 @@ void BOOT_TRANSFER_CNTRL(uint32_t ImageAddress){
 	 */
 
 	uint32_t _stackPtr = * (uint32_t *) ImageAddress;
-    if(RAM_ADDR == (_stackPtr & RAM_ADDR))
+    if(_stackPtr >= RAM_ADDR && _stackPtr <= RAM_ADDR + RAM_SIZE && (_stackPtr & 0x3U) == 0U)
     {
 
     	/* perform system reset */
@@ -108,7 +156,19 @@ void BOOT_TRANSFER_CNTRL(uint32_t ImageAddress){
         	CLEAR_BIT(SYSCFG->MEMRMP, SYSCFG_MEMRMP_MEM_MODE_1);
         }
 
-        else if (FLASH_MEM_ADDR <= ImageAddress )	// Transfer to the Flash memory
+        else if (RAM_ADDR <= ImageAddress && ImageAddress < RAM_ADDR + RAM_SIZE)	// Transfer to the SRAM
+        {
+
+            /* Map address 0x0 to SRAM, as a boot from SRAM does */
+        	SET_BIT(SYSCFG->MEMRMP, SYSCFG_MEMRMP_MEM_MODE_0 | SYSCFG_MEMRMP_MEM_MODE_1);
+
+          /* Vector Table Relocation in Internal SRAM */
+          __DMB();
+          WRITE_REG(SCB->VTOR, ImageAddress);
+          __DSB();
+        }
+
+        else if (FLASH_MEM_ADDR <= ImageAddress && ImageAddress <= FLASH_END)	// Transfer to the Flash memory
         {
 
             /* Map address 0x0 to Flash memory */
@@ -138,58 +198,731 @@ void BOOT_TRANSFER_CNTRL(uint32_t ImageAddress){
 
 /**
  * @brief 	Copy Image from Source location to destination location
- * @note	The function shouldn't return, if returned, an error has occurred.
- * @param   src image address , dest image address , size of the image by bytes
+ * @note	One destination sector at a time : the sector is erased only when its part of
+ * 			the destination can't take the image as it is (BFLASH_PrepareCopy), then the
+ * 			part is programmed by the RAM engine, which skips the words already identical,
+ * 			CPY_CHUNK_SIZE bytes between two progress calls. The data of an erased sector
+ * 			outside of the destination is lost, so no destination sector may hold a part of
+ * 			the source. The flash must be unlocked.
+ * @param   src image address , dest image address , size of the image by bytes (word aligned)
+ * @param   pCrc: CRC32_Compute of the destination once copied (NULL when not needed)
+ * @param   Progress: called with the bytes copied after every chunk (NULL when not needed)
 *  @retval HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
 
  */
-HAL_StatusTypeDef BOOT_CPY_IMAGE(AddressType srcAddress ,AddressType destAddress, SizeType size){
-
+HAL_StatusTypeDef BOOT_CPY_IMAGE(AddressType srcAddress ,AddressType destAddress, SizeType size,
+								 uint32_t *pCrc, BOOT_ProgressType Progress){
 
-	HAL_StatusTypeDef state = HAL_ERROR;
-	DataType  Data;
-
-	uint8_t resend_count = 0;
 	uint32_t idx = 0;
 
+	if (((srcAddress | destAddress | size) & 0x3U) != 0U)
+		return HAL_ERROR;
+
 	while (idx < size)
 	{
+		SizeType length = BFLASH_SectorRemaining(destAddress + idx);
 
-		if (!resend_count){
+		if (length == 0U)
+			return HAL_ERROR;
+		if (length > size - idx)
+			length = size - idx;
 
-			/*Read the current memory location*/
-			Data = * ((DataType *) (srcAddress+idx));
+		if (BFLASH_PrepareCopy(destAddress + idx, (const uint8_t*)(srcAddress + idx), length) != HAL_OK)
+			return HAL_ERROR;
 
-		}
+		for (SizeType end = idx + length; idx < end; )
+		{
+			SizeType chunk = (end - idx < CPY_CHUNK_SIZE) ? (end - idx) : CPY_CHUNK_SIZE;
 
-		// try 3 times as maximum to write the word
-		// If exceeded 3, abort writing.
-		if (resend_count >= 3){
+			if (BFLASH_Program(destAddress + idx, (const uint8_t*)(srcAddress + idx), chunk) != HAL_OK)
+				return HAL_ERROR;
 
-			return state;
+			idx += chunk;
+			if (Progress != NULL)
+				Progress(idx);
 		}
+	}
+
+	if (pCrc != NULL)
+		*pCrc = CRC32_Compute(destAddress, size);
+
+	return HAL_OK;
+
+
+}
+
+
+/**
+ * @brief 	Boot decision made right after SystemInit
+ * @note	Called by Reset_Handler before main : no HAL, the core runs on the HSI and no
+ * 			peripheral is set up. The bootloader is needed when the application asked for
+ * 			it (BOOT_REQUEST_MAGIC in the backup register, consumed here), when the auto-boot
+ * 			is disabled, when the request pin is held low or the host sends during the
+ * 			window (BOOT_HOST_REQUEST), or when no slot can boot (BOOT_SELECT_SLOT).
+ * 			Otherwise the latency is kept and the image of the slot entered directly, there
+ * 			is nothing to tear down. Returns to start the bootloader.
+ * @param   None
+ * @retval  None
+ */
+void BOOT_EARLY_DECISION(void){
+
+	if (BKP_REQUEST == BOOT_REQUEST_MAGIC)
+	{
+		BOOT_BKP_WRITE(&BKP_REQUEST, 0);
+		return;
+	}
+
+	if (!BOOT_HEADER_VALID(BOOT_SLOT_A_ADDRESS) && !BOOT_HEADER_VALID(BOOT_SLOT_B_ADDRESS))
+		return;
+
+	META_Init();
+	uint32_t window = BOOT_GET_WINDOW();
+
+	if (window == BOOT_WINDOW_OFF)
+		return;
+
+	uint32_t decision = BOOT_RESET_TIME();
+
+	if (BOOT_HOST_REQUEST(window * (SystemCoreClock / 1000U)))
+		return;
+
+	// one full CRC after an image changed, the validated marker skips it on the next boots.
+	CRC32_Init();
+	uint8_t slot = BOOT_SELECT_SLOT();
+	__HAL_RCC_CRC_CLK_DISABLE();
+
+	if (slot == BOOT_SLOT_NONE)
+		return;
+
+	BOOT_SAVE_LATENCY(decision, BOOT_RESET_TIME());
+
+	uint32_t entry = ((const BOOT_HeaderType*) SlotAddress[slot])->Entry;
+	uint32_t _stackPtr = *(uint32_t*) entry;
+	void (* Tranfer_ImageLocation)(void) = (void *)(*((uint32_t *)(entry + 4)));
+
+	/* Vector Table Relocation in Internal FLASH */
+	__DMB();
+	WRITE_REG(SCB->VTOR, entry);
+	__DSB();
+
+	__set_MSP(_stackPtr);
+	Tranfer_ImageLocation();
+}
+
+
+/**
+ * @brief 	Check the vector table of an image in flash
+ * @note	The initial stack pointer must be a word aligned address of the SRAM (its top
+ * 			included) and the reset handler a thumb address inside the flash, after the
+ * 			vector table. An erased or partially programmed image fails the check.
+ * @param   ImageAddress: image (vector table) address
+ * @retval  1 when the image looks valid
+ */
+uint8_t BOOT_IMAGE_VALID(AddressType ImageAddress){
+
+	DataType stackPtr = *(DataType*) ImageAddress;
+	DataType resetHandler = *(DataType*)(ImageAddress + 4U);
+
+	if (stackPtr < RAM_ADDR || stackPtr > RAM_ADDR + RAM_SIZE || (stackPtr & 0x3U) != 0U)
+		return 0;
+
+	if ((resetHandler & 0x1U) == 0U || resetHandler <= ImageAddress || resetHandler > FLASH_END)
+		return 0;
+
+	return 1;
+}
+
+
+/**
+ * @brief 	SRAM where the RAM images are loaded
+ * @note	The upper 32K of the SRAM (see the linker script), at a fixed address the images
+ * 			are linked for. Only the buffers declared BOOT_RAM_AREA_DATA live there, the
+ * 			commands using them are refused once a RAM write overwrote them, so a RAM
+ * 			image loaded in it survives until the jump.
+ * @param   pStart: first byte of the area, pEnd: first byte after it
+ * @retval  None
+ */
+void BOOT_RAM_AREA(AddressType *pStart, AddressType *pEnd){
+
+	*pStart = (AddressType) &_sramload;
+	*pEnd = (AddressType) &_eramload;
+
+}
+
+
+/**
+ * @brief 	Check the vector table of an image loaded in the RAM area
+ * @note	The vector table must be inside the area and aligned for VTOR, the initial stack
+ * 			pointer as for a flash image and the reset handler a thumb address inside the
+ * 			area, after the vector table.
+ * @param   ImageAddress: image (vector table) address
+ * @retval  1 when the image looks valid
+ */
+uint8_t BOOT_RAM_IMAGE_VALID(AddressType ImageAddress){
+
+	AddressType start, end;
+
+	BOOT_RAM_AREA(&start, &end);
+
+	if (ImageAddress < start || ImageAddress + 8U > end || (ImageAddress & (BOOT_VECTOR_ALIGN - 1U)) != 0U)
+		return 0;
+
+	DataType stackPtr = *(DataType*) ImageAddress;
+	DataType resetHandler = *(DataType*)(ImageAddress + 4U);
+
+	if (stackPtr < RAM_ADDR || stackPtr > RAM_ADDR + RAM_SIZE || (stackPtr & 0x3U) != 0U)
+		return 0;
+
+	if ((resetHandler & 0x1U) == 0U || resetHandler <= ImageAddress || resetHandler >= end)
+		return 0;
+
+	return 1;
+}
+
+
+/**
+ * @brief 	Check the fields of an image header
+ * @note	The header must be in flash with the image right after it, the entry (vector
+ * 			table) aligned for VTOR inside the image, and the vector table valid. The
+ * 			image isn't read beyond its vector table.
+ * @param   HeaderAddress: header address
+ * @retval  1 when the header is valid
+ */
+uint8_t BOOT_HEADER_VALID(AddressType HeaderAddress){
+
+	const BOOT_HeaderType *pHeader = (const BOOT_HeaderType*) HeaderAddress;
+
+	if (HeaderAddress < FLASH_MEM_ADDR || HeaderAddress > FLASH_END + 1U - BOOT_HEADER_SIZE
+		|| (HeaderAddress & 0x3U) != 0U)
+		return 0;
+
+	if (pHeader->Magic != BOOT_HEADER_MAGIC || pHeader->LoadAddress != HeaderAddress + BOOT_HEADER_SIZE)
+		return 0;
+
+	if (pHeader->Length == 0U || (pHeader->Length & 0x3U) != 0U
+		|| pHeader->Length > FLASH_END + 1U - pHeader->LoadAddress)
+		return 0;
+
+	if (pHeader->Entry < pHeader->LoadAddress || pHeader->Entry - pHeader->LoadAddress >= pHeader->Length
+		|| (pHeader->Entry & (BOOT_HEADER_SIZE - 1U)) != 0U)
+		return 0;
+
+	return BOOT_IMAGE_VALID(pHeader->Entry);
+}
+
+
+/**
+ * @brief 	State of the image of a header
+ * @note	O(1) : the header is checked and compared with its validated marker, the
+ * 			image isn't read. A header changed since the marker was recorded doesn't
+ * 			match it.
+ * @param   HeaderAddress: header address
+ * @retval  BOOT_IMAGE_NONE, BOOT_IMAGE_UNVERIFIED or BOOT_IMAGE_VERIFIED
+ */
+uint8_t BOOT_IMAGE_STATE(AddressType HeaderAddress){
+
+	const BOOT_HeaderType *pHeader = (const BOOT_HeaderType*) HeaderAddress;
+	uint32_t marker[META_DATA_WORDS];
+
+	if (!BOOT_HEADER_VALID(HeaderAddress))
+		return BOOT_IMAGE_NONE;
+
+	if (META_Read(META_TAG_IMAGE, MARKER_KEY(HeaderAddress), marker) == HAL_OK
+		&& marker[0] == pHeader->Crc && marker[1] == pHeader->Length && marker[2] == BOOT_HEADER_FOLD(pHeader))
+		return BOOT_IMAGE_VERIFIED;
+
+	return BOOT_IMAGE_UNVERIFIED;
+}
+
+
+/**
+ * @brief 	Check the CRC of the image of a header
+ * @note	The full CRC pass, done once after the image changed : a matching image gets
+ * 			its validated marker (written only when it isn't there yet), a corrupted one
+ * 			loses it. The flash is unlocked for the marker when needed.
+ * @param   HeaderAddress: header address
+ * @retval  HAL_StatusTypeDef {HAL_OK, or HAL_ERROR when the header or the CRC is invalid}
+ */
+HAL_StatusTypeDef BOOT_IMAGE_VERIFY(AddressType HeaderAddress){
+
+	const BOOT_HeaderType *pHeader = (const BOOT_HeaderType*) HeaderAddress;
+
+	if (!BOOT_HEADER_VALID(HeaderAddress))
+		return HAL_ERROR;
+
+	if (CRC32_Compute(pHeader->LoadAddress, pHeader->Length) != pHeader->Crc)
+	{
+		BOOT_IMAGE_INVALIDATE(HeaderAddress);
+		return HAL_ERROR;
+	}
+
+	if (BOOT_IMAGE_STATE(HeaderAddress) == BOOT_IMAGE_VERIFIED)
+		return HAL_OK;
+
+	uint32_t marker[META_DATA_WORDS] = { pHeader->Crc, pHeader->Length, BOOT_HEADER_FOLD(pHeader) };
+
+	return META_Write(META_TAG_IMAGE, MARKER_KEY(HeaderAddress), marker);
+}
+
+
+/**
+ * @brief 	Drop the validated marker of an image
+ * @note	Nothing is written when there is no marker to drop.
+ * @param   HeaderAddress: header address
+ * @retval  None
+ */
+void BOOT_IMAGE_INVALIDATE(AddressType HeaderAddress){
+
+	uint32_t marker[META_DATA_WORDS];
+
+	if (META_Read(META_TAG_IMAGE, MARKER_KEY(HeaderAddress), marker) != HAL_OK
+		|| (marker[0] | marker[1] | marker[2]) == 0U)
+		return;
+
+	marker[0] = marker[1] = marker[2] = 0;
+	META_Write(META_TAG_IMAGE, MARKER_KEY(HeaderAddress), marker);
+}
+
+
+/**
+ * @brief 	Header address of a slot
+ * @param   slot: slot number
+ * @retval  Header address, zero for an unknown slot
+ */
+uint32_t BOOT_SLOT_ADDRESS(uint8_t slot){
+
+	return (slot < BOOT_SLOTS) ? SlotAddress[slot] : 0U;
+}
+
+
+/**
+ * @brief 	State of a slot
+ * @param   slot: slot number, pSlot: state, BOOT_SLOT_EMPTY when none was recorded
+ * @retval  None
+ */
+void BOOT_GET_SLOT(uint8_t slot, BOOT_SlotType *pSlot){
+
+	uint32_t data[META_DATA_WORDS] = { 0, 0, 0 };
+
+	META_Read(META_TAG_SLOT, slot, data);
+
+	pSlot->State = (uint8_t) data[0];
+	pSlot->Tries = (uint8_t)(data[0] >> SLOT_TRIES_SHIFT);
+	pSlot->Sequence = data[1];
+	pSlot->Crc = data[2];
+}
+
+
+/**
+ * @brief 	Verify the slots
+ * @note	A slot holding a verified image its state doesn't belong to (another CRC)
+ * 			got a new image : it becomes pending, newer than every other slot. That
+ * 			covers the images written by the bootloader and by the application itself.
+ * 			When no slot state is recorded at all (new device, or the metadata log lost
+ * 			to a power loss during a compaction) the states are rebuilt from the image
+ * 			headers : every image is pending again, the highest version the newest, so
+ * 			the trial boots go from the newest image to the oldest.
+ * @param   None
+ * @retval  None
+ */
+void BOOT_SLOTS_UPDATE(void){
+
+	uint8_t order[BOOT_SLOTS];
+	uint8_t count = 0;
+	uint8_t recorded = 0;
+
+	for (uint8_t slot = 0; slot < BOOT_SLOTS; ++slot)
+	{
+		BOOT_SlotType state;
+
+		if (!BOOT_SLOT_IMAGE(slot))
+			continue;
+
+		BOOT_GET_SLOT(slot, &state);
+		if (state.State != BOOT_SLOT_EMPTY)
+			recorded = 1;
+
+		if (state.State != BOOT_SLOT_EMPTY && state.Crc == ((const BOOT_HeaderType*) SlotAddress[slot])->Crc)
+			continue;
+
+		order[count++] = slot;
+	}
 
-		/*Try writing the data*/
-		state = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, destAddress+idx, Data);
+	// the lowest version first, it gets the lowest sequence.
+	for (uint8_t idx = 1; !recorded && idx < count; ++idx)
+	{
+		uint8_t slot = order[idx];
+		uint8_t pos = idx;
+
+		for ( ; pos > 0U && ((const BOOT_HeaderType*) SlotAddress[order[pos - 1U]])->Version
+							> ((const BOOT_HeaderType*) SlotAddress[slot])->Version; --pos)
+			order[pos] = order[pos - 1U];
+		order[pos] = slot;
+	}
+
+	for (uint8_t idx = 0; idx < count; ++idx)
+	{
+		BOOT_SlotType state;
+
+		state.State = BOOT_SLOT_PENDING;
+		state.Tries = 0;
+		state.Sequence = BOOT_NEXT_SEQUENCE();
+		state.Crc = ((const BOOT_HeaderType*) SlotAddress[order[idx]])->Crc;
+		BOOT_SET_SLOT(order[idx], &state);
+	}
+}
+
+
+/**
+ * @brief 	Slot to boot
+ * @note	The confirmation of the last trial image is applied first. A pending image
+ * 			newer than the newest confirmed one is trial-booted (its tries counted and the
+ * 			slot kept in the backup register for the confirmation), up to BOOT_TRIAL_MAX
+ * 			boots after which it fails and the newest confirmed image boots again.
+ * 			A trial boot after the backup domain was lost (power off without VBAT, BKP_TRIAL
+ * 			cleared) isn't counted : the confirmation the image wrote was lost with it, a
+ * 			working image power-cycled would fail otherwise.
+ * @param   None
+ * @retval  Slot number, BOOT_SLOT_NONE when no slot can boot
+ */
+uint8_t BOOT_SELECT_SLOT(void){
+
+	BOOT_SlotType state[BOOT_SLOTS];
+	uint8_t pending = BOOT_SLOT_NONE;
+	uint8_t confirmed = BOOT_SLOT_NONE;
+
+	BOOT_SLOTS_UPDATE();
+	BOOT_APPLY_CONFIRM();
 
-		/*if error occurred increase the resend counter */
-		if (state != HAL_OK){
-			resend_count++;
+	for (uint8_t slot = 0; slot < BOOT_SLOTS; ++slot)
+	{
+		BOOT_GET_SLOT(slot, &state[slot]);
+
+		if (!BOOT_SLOT_IMAGE(slot) || state[slot].Crc != ((const BOOT_HeaderType*) SlotAddress[slot])->Crc)
+			continue;
+
+		if (state[slot].State == BOOT_SLOT_PENDING && state[slot].Tries >= BOOT_TRIAL_MAX)
+		{
+			state[slot].State = BOOT_SLOT_FAILED;
+			BOOT_SET_SLOT(slot, &state[slot]);
 		}
-		else   // the operation has succeeded
+
+		if (state[slot].State == BOOT_SLOT_PENDING
+			&& (pending == BOOT_SLOT_NONE || state[slot].Sequence > state[pending].Sequence))
+			pending = slot;
+
+		if (state[slot].State == BOOT_SLOT_CONFIRMED
+			&& (confirmed == BOOT_SLOT_NONE || state[slot].Sequence > state[confirmed].Sequence))
+			confirmed = slot;
+	}
+
+	if (pending != BOOT_SLOT_NONE
+		&& (confirmed == BOOT_SLOT_NONE || state[pending].Sequence > state[confirmed].Sequence))
+	{
+		if (state[pending].Tries == 0U || BKP_TRIAL != 0U)
 		{
-			resend_count = 0;
-			idx += 4;
+			state[pending].Tries++;
+			BOOT_SET_SLOT(pending, &state[pending]);
 		}
+		BOOT_BKP_WRITE(&BKP_TRIAL, pending + 1U);
+		return pending;
+	}
+
+	if (BKP_TRIAL != 0U)
+		BOOT_BKP_WRITE(&BKP_TRIAL, 0);
+
+	return confirmed;
+}
+
+
+/**
+ * @brief 	Confirm the image of a slot
+ * @note	The slot gets the newest sequence : it boots from now on, over any pending or
+ * 			confirmed image of the other slots. One record, the switch is atomic.
+ * @param   slot: slot number
+ * @retval  HAL_StatusTypeDef {HAL_OK, or HAL_ERROR when the slot holds no valid image}
+ */
+HAL_StatusTypeDef BOOT_CONFIRM_SLOT(uint8_t slot){
+
+	BOOT_SlotType state;
+
+	if (slot >= BOOT_SLOTS || !BOOT_SLOT_IMAGE(slot))
+		return HAL_ERROR;
+
+	state.State = BOOT_SLOT_CONFIRMED;
+	state.Tries = 0;
+	state.Sequence = BOOT_NEXT_SEQUENCE();
+	state.Crc = ((const BOOT_HeaderType*) SlotAddress[slot])->Crc;
+
+	return BOOT_SET_SLOT(slot, &state);
+}
+
+
+/**
+ * @brief 	Mark the switch of the system clock to the PLL
+ * @note	The DWT cycle counter runs from zero since Reset_Handler (startup file), on the
+ * 			HSI until SystemClock_Config, and on the PLL after it.
+ * @param   None
+ * @retval  None
+ */
+void BOOT_MARK_CLOCK(void){
+
+	ClockCycle = DWT->CYCCNT;
+}
+
+
+/**
+ * @brief 	Microseconds elapsed since Reset_Handler
+ * @note	Valid while the counter doesn't wrap (51 s at 84 MHz).
+ * @param   None
+ * @retval  Elapsed time (us)
+ */
+uint32_t BOOT_RESET_TIME(void){
+
+	uint32_t cycles = DWT->CYCCNT;
+
+	return ClockCycle / (HSI_VALUE / 1000000U) + (cycles - ClockCycle) / (SystemCoreClock / 1000000U);
+}
+
+
+/**
+ * @brief 	Host activity window of the auto-boot
+ * @param   None
+ * @retval  Window (ms), BOOT_WINDOW_OFF when the auto-boot is disabled
+ */
+uint32_t BOOT_GET_WINDOW(void){
+
+	uint32_t data[META_DATA_WORDS];
+
+	if (META_Read(META_TAG_BOOT, BOOT_KEY_WINDOW, data) != HAL_OK)
+		return BOOT_WINDOW_DEFAULT;
+
+	if (data[0] > BOOT_WINDOW_MAX && data[0] != BOOT_WINDOW_OFF)
+		return BOOT_WINDOW_DEFAULT;
+
+	return data[0];
+}
+
+
+/**
+ * @brief 	Keep a new host activity window
+ * @note	Only written when it changes, the metadata sector wears on every record.
+ * @param   window: window (ms) up to BOOT_WINDOW_MAX, zero to boot at once, BOOT_WINDOW_OFF to disable the auto-boot
+ * @retval  HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
+ */
+HAL_StatusTypeDef BOOT_SET_WINDOW(uint32_t window){
+
+	uint32_t data[META_DATA_WORDS] = { window, 0, 0 };
+
+	if (window > BOOT_WINDOW_MAX && window != BOOT_WINDOW_OFF)
+		return HAL_ERROR;
+
+	if (BOOT_GET_WINDOW() == window)
+		return HAL_OK;
+
+	return META_Write(META_TAG_BOOT, BOOT_KEY_WINDOW, data);
+}
+
+
+/**
+ * @brief 	Keep the latency of an auto-boot
+ * @note	The RTC backup registers survive the jump, the application and the system
+ * 			resets, the next bootloader session reads them back.
+ * @param   decision: reset to the start of the host activity window (us), boot: reset to the jump (us)
+ * @retval  None
+ */
+void BOOT_SAVE_LATENCY(uint32_t decision, uint32_t boot){
+
+	BOOT_BKP_WRITE(&BKP_BOOT, boot);
+	BOOT_BKP_WRITE(&BKP_DECISION, decision);
+	BOOT_BKP_WRITE(&BKP_CHECK, ~boot);
+}
+
 
+/**
+ * @brief 	Latency of the last auto-boot
+ * @note	Only the LastBoot and LastDecision fields are filled.
+ * @param   pLatency: latency, zero when none was kept (power on)
+ * @retval  None
+ */
+void BOOT_GET_LATENCY(BOOT_LatencyType *pLatency){
+
+	pLatency->LastBoot = 0;
+	pLatency->LastDecision = 0;
+
+	if (BKP_CHECK == ~BKP_BOOT)
+	{
+		pLatency->LastBoot = BKP_BOOT;
+		pLatency->LastDecision = BKP_DECISION;
 	}
+}
+
+
+
+/**
+ * @brief 	Fold of the header words, kept in the validated marker
+ * @param   pHeader: image header
+ * @retval  Fold
+ */
+static uint32_t BOOT_HEADER_FOLD(const BOOT_HeaderType *pHeader){
+
+	return pHeader->Magic ^ pHeader->Version ^ pHeader->LoadAddress
+			^ pHeader->Length ^ pHeader->Entry ^ pHeader->Crc;
+}
+
+
+/**
+ * @brief 	Write a backup register
+ * @note	The backup domain is write protected again and the PWR clock left as it was
+ * 			(off before the clock setup, as after the reset).
+ * @param   pRegister: RTC backup register, value: value to write
+ * @retval  None
+ */
+static void BOOT_BKP_WRITE(__IO uint32_t *pRegister, uint32_t value){
+
+	uint32_t pwrClock = __HAL_RCC_PWR_IS_CLK_ENABLED();
 
-	return state;
+	__HAL_RCC_PWR_CLK_ENABLE();
+	HAL_PWR_EnableBkUpAccess();
 
+	*pRegister = value;
 
+	HAL_PWR_DisableBkUpAccess();
+	if (!pwrClock)
+		__HAL_RCC_PWR_CLK_DISABLE();
 }
 
 
+/**
+ * @brief 	Check the image of a slot
+ * @note	O(1) once the image is verified, a full CRC pass otherwise.
+ * @param   slot: slot number
+ * @retval  1 when the slot holds a verified image fitting in it
+ */
+static uint8_t BOOT_SLOT_IMAGE(uint8_t slot){
+
+	AddressType HeaderAddress = SlotAddress[slot];
+
+	if (!BOOT_HEADER_VALID(HeaderAddress)
+		|| ((const BOOT_HeaderType*) HeaderAddress)->Length > SlotSize[slot] - BOOT_HEADER_SIZE)
+		return 0;
+
+	if (BOOT_IMAGE_STATE(HeaderAddress) == BOOT_IMAGE_VERIFIED)
+		return 1;
+
+	return BOOT_IMAGE_VERIFY(HeaderAddress) == HAL_OK;
+}
+
+
+/**
+ * @brief 	Record the state of a slot
+ * @param   slot: slot number, pSlot: state
+ * @retval  HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
+ */
+static HAL_StatusTypeDef BOOT_SET_SLOT(uint8_t slot, const BOOT_SlotType *pSlot){
+
+	uint32_t data[META_DATA_WORDS] = { pSlot->State | ((uint32_t) pSlot->Tries << SLOT_TRIES_SHIFT),
+									   pSlot->Sequence, pSlot->Crc };
+
+	return META_Write(META_TAG_SLOT, slot, data);
+}
+
+
+/**
+ * @brief 	Sequence of a new image, after the images of every slot
+ * @param   None
+ * @retval  Sequence
+ */
+static uint32_t BOOT_NEXT_SEQUENCE(void){
+
+	uint32_t sequence = 0;
+
+	for (uint8_t slot = 0; slot < BOOT_SLOTS; ++slot)
+	{
+		BOOT_SlotType state;
+
+		BOOT_GET_SLOT(slot, &state);
+		if (state.Sequence > sequence)
+			sequence = state.Sequence;
+	}
+
+	return sequence + 1U;
+}
+
+
+/**
+ * @brief 	Apply the confirmation of the last trial image
+ * @note	The trial image writes BOOT_CONFIRM_MAGIC in the backup register once it runs
+ * 			fine, its slot (if still pending) is confirmed on the next boot. The image can make
+ * 			it durable at once with a system reset after the write. A confirmation lost with
+ * 			the backup domain (power off) is written again by the image, that trial boot
+ * 			isn't counted (BOOT_SELECT_SLOT).
+ * @param   None
+ * @retval  None
+ */
+static void BOOT_APPLY_CONFIRM(void){
+
+	uint32_t trial = BKP_TRIAL;
+	BOOT_SlotType state;
+
+	if (BKP_CONFIRM != BOOT_CONFIRM_MAGIC)
+		return;
+
+	BOOT_BKP_WRITE(&BKP_CONFIRM, 0);
+
+	if (trial == 0U || trial > BOOT_SLOTS)
+		return;
+
+	BOOT_GET_SLOT(trial - 1U, &state);
+	if (state.State == BOOT_SLOT_PENDING)
+	{
+		state.State = BOOT_SLOT_CONFIRMED;
+		state.Tries = 0;
+		BOOT_SET_SLOT(trial - 1U, &state);
+	}
+}
+
+
+/**
+ * @brief 	Host request of the early boot decision
+ * @note	Pulls up the request pin and the USART1 RX pin, then watches them for
+ * 			windowCycles (at least one read) : the request pin low, or a start bit on the
+ * 			RX line, is a request. The byte received meanwhile is lost, the host sends
+ * 			wake bytes the frame parser skips. GPIOA is left as after the reset.
+ * @param   windowCycles: DWT cycles to watch the pins
+ * @retval  1 when the bootloader is requested
+ */
+static uint8_t BOOT_HOST_REQUEST(uint32_t windowCycles){
+
+	const uint32_t pins = (1U << BOOT_REQUEST_PIN) | (1U << BOOT_RX_PIN);
+	uint8_t request = 0;
+
+	RCC->AHB1ENR |= RCC_AHB1ENR_GPIOAEN;
+	(void) RCC->AHB1ENR;
+
+	uint32_t pupdr = GPIOA->PUPDR;
+	GPIOA->PUPDR = (pupdr & ~((3U << (BOOT_REQUEST_PIN * 2U)) | (3U << (BOOT_RX_PIN * 2U))))
+					| (1U << (BOOT_REQUEST_PIN * 2U)) | (1U << (BOOT_RX_PIN * 2U));
+
+	uint32_t startCycle = DWT->CYCCNT;
+	while (DWT->CYCCNT - startCycle < PIN_SETTLE_CYCLES);
+
+	startCycle = DWT->CYCCNT;
+	do
+	{
+		if ((GPIOA->IDR & pins) != pins)
+		{
+			request = 1;
+			break;
+		}
+	} while (DWT->CYCCNT - startCycle < windowCycles);
+
+	GPIOA->PUPDR = pupdr;
+	RCC->AHB1ENR &= ~RCC_AHB1ENR_GPIOAEN;
+
+	return request;
+}
+
 
 /**
  * @brief 	clears all the configuration that the Boot Loader made and made every thing as just a reset happened;
@@ -202,8 +935,15 @@ static void BOOT_SYS_RESET(void){
     /* Disable all interrupts */
     __disable_irq();
 
+    /* Disable and clear all the peripheral interrupts (USART1, DMA2 stream) */
+    for (uint8_t idx = 0; idx < 8U; ++idx)
+    {
+    	NVIC->ICER[idx] = 0xFFFFFFFFU;
+    	NVIC->ICPR[idx] = 0xFFFFFFFFU;
+    }
+
     /* Reset GPIOA and DMA2 */
-    RCC->AHB1RSTR = RCC_AHB1RSTR_GPIOARST;
+    RCC->AHB1RSTR = RCC_AHB1RSTR_GPIOARST | RCC_AHB1RSTR_DMA2RST;
 
     /* Release reset */
     RCC->AHB1RSTR = 0;
@@ -0,0 +1,382 @@
+/*******************************************************************************
+ * @file    boot_comm.c
+ * @author  Mohammed Khaled
+ * @email   Mohammed.kh384@gmail.com
+ * @website EMSTutorials.blogspot.com/
+ * @Created on: Mar 12, 2023
+ *
+ * @brief   this source file contains the implementation of the host communication APIs.
+ * @note	The DMA writes USART1 data into RxRing without CPU intervention, so bytes
+ * 			arriving while a process handler is running are not lost as long as the
+ * 			host keeps less than COMM_RING_SIZE bytes in flight.
+ *
+@verbatim
+Copyright (C) EMSTutorials, 2019
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+@endverbatim
+*******************************************************************************/
+
+/**************** Includes ********************/
+#include "boot_comm.h"
+#include "BOOT_PROCESS.h"
+#include <string.h>
+
+
+/**
+ * @defgroup  private local variables
+ * @brief
+ * @{
+ */
+
+extern UART_HandleTypeDef huart1;
+
+
+/**
+  * @}
+  */
+
+/**
+ * @defgroup  private local defines
+ * @brief
+ * @{
+ */
+
+#define 	RING_MASK				(COMM_RING_SIZE - 1U)
+
+#define 	DMA_POSITION()			((uint16_t)((COMM_RING_SIZE - __HAL_DMA_GET_COUNTER(huart1.hdmarx)) & RING_MASK))
+
+/**
+  * @}
+  */
+
+/**
+ * @defgroup  private local types
+ * @brief
+ * @{
+ */
+
+static uint8_t RxRing[COMM_RING_SIZE];				// written by DMA2 Stream2 in circular mode.
+
+static volatile uint32_t RxWritten;				// total bytes written by the DMA up to the last event.
+static volatile uint16_t RxLastPos;				// ring position of the last event.
+static volatile uint8_t  RxRestart;				// set when the reception had to be restarted.
+
+static uint32_t RxRead;							// total bytes consumed by the frame parser.
+static uint32_t FrameLen;						// expected length of the frame under assembly.
+static uint32_t FrameIdx;						// bytes of the frame already received.
+static uint16_t HeaderLen;						// bytes of the frame going to RxBuffer, the rest goes to RxPayload.
+static uint32_t LastWritten;					// bytes written when the line was last seen active.
+static uint32_t LastRxTick;						// HAL tick of that moment.
+
+
+/**
+  * @}
+  */
+
+/**
+ * @defgroup  private local functions
+ * @brief
+ * @{
+ */
+
+static void COMM_START(void);
+static void COMM_ADVANCE(uint16_t position);
+static uint32_t COMM_WRITTEN(void);
+static uint32_t COMM_OVERSAMPLING(uint32_t baudRate);
+
+
+/**
+* @}
+*/
+
+
+/**
+ * @brief	Start the circular DMA reception on USART1
+ * @note	Must be called after MX_USART1_UART_Init and PROCESS_INIT.
+ * @param   None
+ * @retval  None
+ */
+void COMM_Init(void){
+
+	RxWritten = 0;
+	RxRead = 0;
+	FrameIdx = 0;
+	LastWritten = 0;
+	LastRxTick = HAL_GetTick();
+
+	COMM_START();
+}
+
+
+/**
+ * @brief	Drain the ring and rebuild the next command frame into RxBuffer
+ * @note	The command byte selects the frame length from Process_FrameSize,
+ * 			unknown command bytes are skipped. A partial frame is discarded once the
+ * 			line stays silent for COMM_FRAME_TIMEOUT, so the parser resyncs on the next
+ * 			frame. The short gaps of the USB-serial adapters between their packets
+ * 			don't split a frame.
+ * 			Commands with a payload length field (Process_PayloadLenOffset) continue
+ * 			with that many bytes into RxPayload, a payload longer than RX_PAYLOAD_SIZE
+ * 			is drained but not stored and left to the handler to reject.
+ * @param   None
+ * @retval  Length of the completed frame, 0 if no complete frame is available yet.
+ */
+uint32_t COMM_GetFrame(void){
+
+	uint32_t written = COMM_WRITTEN();
+
+	/* The DMA lapped the parser, the ring content is not trustworthy anymore */
+	if ((written - RxRead) > COMM_RING_SIZE)
+	{
+		RxRead = written;
+		FrameIdx = 0;
+		return 0;
+	}
+
+	/* The rest of a partial frame didn't come within the timeout, it was lost */
+	if (written != LastWritten)
+	{
+		LastWritten = written;
+		LastRxTick = HAL_GetTick();
+	}
+	else if (FrameIdx != 0U && RxRead == written && (HAL_GetTick() - LastRxTick) >= COMM_FRAME_TIMEOUT)
+	{
+		FrameIdx = 0;
+	}
+
+	while (1)
+	{
+		if (RxRead == written)
+			return 0;
+
+		if (FrameIdx >= HeaderLen && FrameIdx != 0)
+		{
+			/* Payload, copy the contiguous part of the ring at once */
+			uint32_t count = written - RxRead;
+			uint32_t offset = RxRead & RING_MASK;
+
+			if (count > FrameLen - FrameIdx)
+				count = FrameLen - FrameIdx;
+			if (count > COMM_RING_SIZE - offset)
+				count = COMM_RING_SIZE - offset;
+
+			if (RxPayloadLen <= RX_PAYLOAD_SIZE)
+				memcpy(&RxPayload[FrameIdx - HeaderLen], &RxRing[offset], count);
+
+			RxRead += count;
+			FrameIdx += count;
+		}
+		else
+		{
+			uint8_t byte = RxRing[RxRead & RING_MASK];
+			RxRead++;
+
+			if (FrameIdx == 0)
+			{
+				/* Not a registered command, skip it and look for the next command byte */
+				if (byte >= PROCESS_NUMBER || Process_FrameSize[byte] == 0U)
+					continue;
+
+				FrameLen = HeaderLen = Process_FrameSize[byte];
+			}
+
+			RxBuffer[FrameIdx++] = byte;
+
+			/* Header complete, add the announced payload */
+			if (FrameIdx == HeaderLen && Process_PayloadLenOffset[RxBuffer[0]] != 0U)
+			{
+				RxPayloadLen = *((uint16_t*) &RxBuffer[Process_PayloadLenOffset[RxBuffer[0]]]);
+				FrameLen += RxPayloadLen;
+			}
+		}
+
+		if (FrameIdx == FrameLen)
+		{
+			FrameIdx = 0;
+			return FrameLen;
+		}
+	}
+}
+
+
+/**
+ * @brief	Number of received bytes not consumed by the frame parser yet
+ * @note	Used to coalesce the replies while the host is still streaming.
+ * @param   None
+ * @retval  Pending bytes in the ring.
+ */
+uint32_t COMM_Pending(void){
+
+	return COMM_WRITTEN() - RxRead;
+}
+
+
+/**
+ * @brief	Check that USART1 can generate a baud rate
+ * @note	USART1 is clocked by PCLK2 (84 MHz), 16x oversampling is kept up to PCLK2/16
+ * 			for its better noise immunity, 8x oversampling goes up to PCLK2/8.
+ * @param   baudRate: requested baud rate
+ * @retval  HAL_OK if the generated rate is within COMM_BAUD_MAX_ERROR percent, HAL_ERROR otherwise
+ */
+HAL_StatusTypeDef COMM_CheckBaudRate(uint32_t baudRate){
+
+	uint32_t pclk = HAL_RCC_GetPCLK2Freq();
+	uint32_t divider;
+
+	if (baudRate == 0U || baudRate > (pclk >> 3U))
+		return HAL_ERROR;
+
+	if (COMM_OVERSAMPLING(baudRate) == UART_OVERSAMPLING_8)
+	{
+		uint32_t brr = UART_BRR_SAMPLING8(pclk, baudRate);
+		divider = ((brr & 0xFFF0U) >> 1U) + (brr & 0x7U);		// 8 x USARTDIV
+	}
+	else
+	{
+		divider = UART_BRR_SAMPLING16(pclk, baudRate);		// 16 x USARTDIV
+	}
+
+	if (divider == 0U)
+		return HAL_ERROR;
+
+	uint32_t actual = pclk / divider;
+	uint32_t deviation = (actual > baudRate) ? (actual - baudRate) : (baudRate - actual);
+
+	if ((uint64_t)deviation * 100U > (uint64_t)baudRate * COMM_BAUD_MAX_ERROR)
+		return HAL_ERROR;
+
+	return HAL_OK;
+}
+
+
+/**
+ * @brief	Reconfigure USART1 to a new baud rate
+ * @note	Must be called once the last reply is fully transmitted (HAL_UART_Transmit
+ * 			returns after TC), the reception restarts from an empty ring.
+ * @param   baudRate: new baud rate
+ * @retval  HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
+ */
+HAL_StatusTypeDef COMM_SetBaudRate(uint32_t baudRate){
+
+	if (COMM_CheckBaudRate(baudRate) != HAL_OK)
+		return HAL_ERROR;
+
+	HAL_UART_AbortReceive(&huart1);
+
+	huart1.Init.BaudRate = baudRate;
+	huart1.Init.OverSampling = COMM_OVERSAMPLING(baudRate);
+	if (HAL_UART_Init(&huart1) != HAL_OK)
+		return HAL_ERROR;
+
+	COMM_Init();
+
+	return HAL_OK;
+}
+
+
+/**
+ * @brief	Rx event callback, called by HAL on DMA half transfer, transfer complete and idle line
+ * @param   huart: UART handle pointer, Size: ring position of the event
+ * @retval  None
+ */
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size){
+
+	if (huart->Instance == USART1)
+		COMM_ADVANCE(Size & RING_MASK);
+}
+
+
+/**
+ * @brief	UART error callback
+ * @note	In DMA mode HAL aborts the reception on any line error, restart it and resync.
+ * @param   huart: UART handle pointer
+ * @retval  None
+ */
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart){
+
+	if (huart->Instance == USART1 && huart->RxState == HAL_UART_STATE_READY)
+	{
+		RxWritten = 0;
+		RxRestart = 1;
+		COMM_START();
+	}
+}
+
+
+/**
+ * @brief	(Re)start the circular reception from the beginning of the ring
+ * @param   None
+ * @retval  None
+ */
+static void COMM_START(void){
+
+	RxLastPos = 0;
+	HAL_UARTEx_ReceiveToIdle_DMA(&huart1, RxRing, COMM_RING_SIZE);
+}
+
+
+/**
+ * @brief	Account the bytes written by the DMA since the last event
+ * @note	Events occur at least every half ring, so the distance is never ambiguous.
+ * @param   position: current ring position of the DMA
+ * @retval  None
+ */
+static void COMM_ADVANCE(uint16_t position){
+
+	RxWritten += (uint16_t)(position - RxLastPos) & RING_MASK;
+	RxLastPos = position;
+}
+
+
+/**
+ * @brief	Oversampling used for a baud rate
+ * @param   baudRate: requested baud rate
+ * @retval  UART_OVERSAMPLING_16 up to PCLK2/16, UART_OVERSAMPLING_8 above
+ */
+static uint32_t COMM_OVERSAMPLING(uint32_t baudRate){
+
+	return (baudRate > (HAL_RCC_GetPCLK2Freq() >> 4U)) ? UART_OVERSAMPLING_8 : UART_OVERSAMPLING_16;
+}
+
+
+/**
+ * @brief	Total bytes written by the DMA so far
+ * @note	Snapshot taken with the interrupts masked so it doesn't race the HT/TC/IDLE events.
+ * @param   None
+ * @retval  Total bytes written into the ring.
+ */
+static uint32_t COMM_WRITTEN(void){
+
+	uint32_t written;
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	if (RxRestart)
+	{
+		RxRestart = 0;
+		RxRead = 0;
+		FrameIdx = 0;
+	}
+	written = RxWritten + ((DMA_POSITION() - RxLastPos) & RING_MASK);
+	__set_PRIMASK(primask);
+
+	return written;
+}
+
+
+/**
+ * @}
+ */
+/**
+ * @}
+ */
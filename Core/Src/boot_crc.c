@@ -0,0 +1,165 @@
+/*******************************************************************************
+ * @file    boot_crc.c
+ * @author  Mohammed Khaled
+ * @email   Mohammed.kh384@gmail.com
+ * @website EMSTutorials.blogspot.com/
+ * @Created on: Mar 24, 2023
+ *
+ * @brief   this source file contains the implementation of the flash CRC APIs.
+ * @note	Computed by the CRC unit, fed by DMA2 memory-to-memory transfers from the
+ * 			flash to CRC->DR (the CRC unit has no DMA request). The CPU feeds it if the
+ * 			DMA can't be used. The host computes the same value over its image.
+ *
+@verbatim
+Copyright (C) EMSTutorials, 2019
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+@endverbatim
+*******************************************************************************/
+
+/**************** Includes ********************/
+#include "boot_crc.h"
+
+
+/**
+ * @defgroup  private local defines
+ * @brief
+ * @{
+ */
+
+#define 	CRC32_DMA_MAX_WORDS		0xFFFFU			// NDTR is 16 bits.
+#define 	CRC32_DMA_TIMEOUT		100U			// ms for CRC32_DMA_MAX_WORDS words, HSI included.
+
+/**
+  * @}
+  */
+
+
+/**
+ * @defgroup  private local variables
+ * @brief
+ * @{
+ */
+
+extern DMA_HandleTypeDef hdma_memtomem_dma2_stream0;
+
+/**
+  * @}
+  */
+
+
+/**
+ * @defgroup  private local functions
+ * @brief
+ * @{
+ */
+
+static HAL_StatusTypeDef CRC32_DMA_FEED(uint32_t Address, uint32_t words);
+
+/**
+  * @}
+  */
+
+
+/**
+ * @brief	Enable the CRC unit clock
+ * @param   None
+ * @retval  None
+ */
+void CRC32_Init(void){
+
+	__HAL_RCC_CRC_CLK_ENABLE();
+}
+
+
+/**
+ * @}
+ */
+
+
+/**
+ * @brief	CRC of a word aligned memory area
+ * @note	Words are read as stored (little endian) and shifted in MSB first by the CRC
+ * 			unit : polynomial 0x04C11DB7, initial value 0xFFFFFFFF, no final XOR. The CPU
+ * 			feeds the unit when the DMA isn't set up (boot decision before main).
+ * @param   Address: start of the area, size: number of bytes (multiple of 4)
+ * @retval  CRC-32
+ */
+uint32_t CRC32_Compute(uint32_t Address, uint32_t size){
+
+	CRC->CR = CRC_CR_RESET;
+
+	if (hdma_memtomem_dma2_stream0.State != HAL_DMA_STATE_READY
+		|| CRC32_DMA_FEED(Address, size >> 2U) != HAL_OK)
+	{
+		CRC->CR = CRC_CR_RESET;
+
+		for (uint32_t idx = 0; idx < size; idx += 4U)
+			CRC->DR = *((uint32_t*)(Address + idx));
+	}
+
+	return CRC->DR;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Feed the CRC unit by DMA
+ * @note	Source (peripheral port) incremented, destination CRC->DR fixed, in
+ * 			chunks of CRC32_DMA_MAX_WORDS words.
+ * @param   Address: start of the area, words: number of words
+ * @retval  HAL_StatusTypeDef {HAL_OK, or HAL_ERROR/HAL_BUSY/HAL_TIMEOUT if the DMA failed}
+ */
+static HAL_StatusTypeDef CRC32_DMA_FEED(uint32_t Address, uint32_t words){
+
+	HAL_StatusTypeDef status = HAL_OK;
+
+	while (words != 0U && status == HAL_OK)
+	{
+		uint32_t chunk = (words > CRC32_DMA_MAX_WORDS) ? CRC32_DMA_MAX_WORDS : words;
+
+		status = HAL_DMA_Start(&hdma_memtomem_dma2_stream0, Address, (uint32_t) &CRC->DR, chunk);
+		if (status == HAL_OK)
+			status = HAL_DMA_PollForTransfer(&hdma_memtomem_dma2_stream0, HAL_DMA_FULL_TRANSFER, CRC32_DMA_TIMEOUT);
+
+		Address += chunk << 2U;
+		words -= chunk;
+	}
+
+	// the poll timeout leaves the handle READY, HAL_DMA_Abort would then refuse and the
+	// stream would keep writing CRC->DR under the CPU fallback : it is stopped here.
+	if (status != HAL_OK)
+	{
+		DMA_HandleTypeDef *hdma = &hdma_memtomem_dma2_stream0;
+
+		__HAL_DMA_DISABLE(hdma);
+		while ((hdma->Instance->CR & DMA_SxCR_EN) != 0U);
+
+		__HAL_DMA_CLEAR_FLAG(hdma, __HAL_DMA_GET_TC_FLAG_INDEX(hdma) | __HAL_DMA_GET_HT_FLAG_INDEX(hdma)
+			| __HAL_DMA_GET_TE_FLAG_INDEX(hdma) | __HAL_DMA_GET_DME_FLAG_INDEX(hdma) | __HAL_DMA_GET_FE_FLAG_INDEX(hdma));
+		hdma->State = HAL_DMA_STATE_READY;
+		__HAL_UNLOCK(hdma);
+	}
+
+	return status;
+}
+
+
+/**
+ * @}
+ */
+/**
+ * @}
+ */
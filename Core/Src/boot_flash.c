@@ -0,0 +1,908 @@
+/*******************************************************************************
+ * @file    boot_flash.c
+ * @author  Mohammed Khaled
+ * @email   Mohammed.kh384@gmail.com
+ * @website EMSTutorials.blogspot.com/
+ * @Created on: Mar 28, 2023
+ *
+ * @brief   this source file contains the implementation of the flash programming engine.
+ * @note	HAL_FLASH_Program locks the driver, polls the SR through HAL_GetTick and runs
+ * 			from flash, so every word also stalls the instruction fetch. The engine loop
+ * 			runs from RAM and only waits on BSY between two words.
+ * 			The auto erase keeps the erased sectors of the session in a bit mask : the first
+ * 			write into a sector erases it, and the sector after the last one written is
+ * 			erased ahead (started from the main loop while the link is idle, then polled),
+ * 			so the erase stall mostly overlaps the transfer of the current sector.
+ * 			Every erase is preceded by a blank check : a sector still blank (a new board,
+ * 			a sector erased and never written) is kept as it is, saving the erase time
+ * 			and a program/erase cycle. Every erase is timed and accounted in the wear
+ * 			records of the metadata log, the metadata sector itself is never erased here.
+ * 			The write coalescing buffer maps a word aligned flash area : a write continuing
+ * 			the bytes held is appended, any other write flushes them first. A flush programs
+ * 			the whole words through the engine loop and only the head and tail fragments
+ * 			(bytes of a word not fully held) by byte or halfword.
+ *
+@verbatim
+Copyright (C) EMSTutorials, 2019
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+@endverbatim
+*******************************************************************************/
+
+/**************** Includes ********************/
+#include "boot_flash.h"
+#include "boot_meta.h"
+#include <string.h>
+
+
+/**
+ * @defgroup  private local variables
+ * @brief
+ * @{
+ */
+
+extern FLASH_ProcessTypeDef pFlash;			// HAL flash driver state, holds the error code.
+extern uint32_t _sidata, _sdata, _edata;		// bootloader image end, see the linker script.
+
+static const uint32_t SectorAddress[FLASH_SECTOR_TOTAL + 1U] = {	// STM32F401CC : 4 x 16 KB, 64 KB, 128 KB.
+		0x08000000U, 0x08004000U, 0x08008000U, 0x0800C000U, 0x08010000U, 0x08020000U, 0x08040000U };
+
+static uint8_t SessionErased;					// bit n : sector n erased in this session.
+static uint8_t AutoErase;
+static uint32_t EraseLimit;						// the lookahead never erases a sector starting at or above.
+static uint8_t LookaheadSector = BFLASH_NO_SECTOR;	// next sector to erase in the background.
+static uint8_t ErasingSector = BFLASH_NO_SECTOR;	// background erase in progress.
+static uint32_t EraseStartCycle;				// DWT cycle the background erase started.
+
+static uint8_t CoalesceBuffer[BFLASH_COALESCE_SIZE] __ALIGNED(4);	// write coalescing buffer.
+static uint32_t CoalesceAddress;				// flash address of CoalesceBuffer[0], word aligned.
+static uint32_t CoalesceHead;					// first byte held, CoalesceHead == CoalesceEnd when empty.
+static uint32_t CoalesceEnd;					// end of the bytes held.
+static BFLASH_WriteStatsType WriteStats;
+
+/**
+  * @}
+  */
+
+/**
+ * @defgroup  private local defines
+ * @brief
+ * @{
+ */
+
+#define 	ERASED_WORD				(0xFFFFFFFFU)
+#define 	BLANK_UNROLL			(8U)				// words compared per step of the blank check.
+#define 	SR_ERRORS				(FLASH_SR_SOP | FLASH_SR_WRPERR | FLASH_SR_PGAERR | \
+									 FLASH_SR_PGPERR | FLASH_SR_PGSERR | FLASH_SR_RDERR)
+
+/**
+  * @}
+  */
+
+/**
+ * @defgroup  private local functions
+ * @brief
+ * @{
+ */
+
+static __RAM_FUNC uint32_t BFLASH_PROGRAM_WORDS(volatile uint32_t *pDest, const uint32_t *pSrc, uint32_t count);
+static __RAM_FUNC uint32_t BFLASH_PROGRAM_UNIT(uint32_t Address, uint16_t data, uint32_t psize);
+static HAL_StatusTypeDef BFLASH_PROGRAM_FRAGMENT(uint32_t Address, const uint8_t *pData, uint32_t size);
+static HAL_StatusTypeDef BFLASH_COALESCE_PROGRAM(void);
+static uint8_t BFLASH_PROGRAMMABLE(uint32_t Address, const uint8_t *pData, uint32_t size);
+static void BFLASH_SET_ERROR(uint32_t errors);
+static uint8_t BFLASH_BOOT_SECTORS(void);
+static uint32_t BFLASH_ELAPSED_US(uint32_t startCycle);
+static HAL_StatusTypeDef BFLASH_ERASE_AREA(uint32_t Address, uint32_t size);
+
+/**
+* @}
+*/
+
+
+/**
+ * @brief	Program a word aligned area from a buffer
+ * @note	The flash must be unlocked. 0xFFFFFFFF words are skipped, erased flash already
+ * 			holds them and programming them can't change a programmed word either. Words
+ * 			already holding their data are skipped too (copies over an identical image).
+ * 			On error HAL_FLASH_GetError() returns the HAL_FLASH_ERROR_xxx flags of the failure.
+ * @param   Address: flash address, pData: data, size: number of bytes (multiple of 4)
+ * @retval  HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
+ */
+HAL_StatusTypeDef BFLASH_Program(uint32_t Address, const uint8_t *pData, uint32_t size){
+
+	pFlash.ErrorCode = HAL_FLASH_ERROR_NONE;
+
+	uint32_t errors = BFLASH_PROGRAM_WORDS((volatile uint32_t*) Address, (const uint32_t*) pData, size >> 2U);
+
+	if (errors != 0U)
+	{
+		BFLASH_SET_ERROR(errors);
+		return HAL_ERROR;
+	}
+
+	return HAL_OK;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Blank check
+ * @note	Compares BLANK_UNROLL words at a time (AND of the words against the erased
+ * 			value), the word found not erased is then located one word at a time.
+ * @param   Address: start of the area (word aligned), size: number of bytes (multiple of 4)
+ * @retval  Address of the first word not erased, Address + size when the area is blank
+ */
+uint32_t BFLASH_BlankCheck(uint32_t Address, uint32_t size){
+
+	const uint32_t *pWord = (const uint32_t*) Address;
+	uint32_t count = size >> 2U;
+
+	while (count >= BLANK_UNROLL)
+	{
+		if ((pWord[0] & pWord[1] & pWord[2] & pWord[3] & pWord[4] & pWord[5] & pWord[6] & pWord[7]) != ERASED_WORD)
+			break;
+
+		pWord += BLANK_UNROLL;
+		count -= BLANK_UNROLL;
+	}
+
+	for (; count != 0U; --count, ++pWord)
+		if (*pWord != ERASED_WORD)
+			return (uint32_t) pWord;
+
+	return Address + size;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Erase sectors, skipping the blank ones
+ * @note	Same SectorError convention as HAL_FLASHEx_Erase. The sectors erased or
+ * 			found blank are recorded in the program session, the erases in the wear log.
+ * @param   sector: first sector, nbSectors: number of sectors
+ * @param   SectorError: 0xFFFFFFFF, or the sector that failed
+ * @retval  HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
+ */
+HAL_StatusTypeDef BFLASH_EraseSectors(uint32_t sector, uint32_t nbSectors, uint32_t *SectorError){
+
+	BFLASH_Wait();
+
+	*SectorError = 0xFFFFFFFFU;
+
+	for (; nbSectors != 0U; --nbSectors, ++sector)
+	{
+		if (sector >= FLASH_SECTOR_TOTAL)
+		{
+			*SectorError = sector;
+			return HAL_ERROR;
+		}
+
+		if (!BFLASH_SectorBlank(sector))
+		{
+			FLASH_EraseInitTypeDef strInit;
+
+			strInit.Banks = FLASH_BANK_1;
+			strInit.Sector = sector;
+			strInit.NbSectors = 1;
+			strInit.TypeErase = FLASH_TYPEERASE_SECTORS;
+			strInit.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+
+			uint32_t startCycle = DWT->CYCCNT;
+
+			if (HAL_FLASHEx_Erase(&strInit, SectorError) != HAL_OK)
+				return HAL_ERROR;
+
+			META_RecordErase((uint8_t) sector, BFLASH_ELAPSED_US(startCycle));
+		}
+
+		SessionErased |= (uint8_t)(1U << sector);
+	}
+
+	return HAL_OK;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Check that a whole sector is blank
+ * @param   sector: sector number
+ * @retval  1 when every word of the sector is erased
+ */
+uint8_t BFLASH_SectorBlank(uint8_t sector){
+
+	uint32_t size = SectorAddress[sector + 1U] - SectorAddress[sector];
+
+	return BFLASH_BlankCheck(SectorAddress[sector], size) == SectorAddress[sector] + size;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Sector holding an address
+ * @param   Address: flash address
+ * @retval  Sector number, BFLASH_NO_SECTOR outside of the flash
+ */
+uint8_t BFLASH_SectorOf(uint32_t Address){
+
+	for (uint8_t sector = 0; sector < FLASH_SECTOR_TOTAL; ++sector)
+		if (Address >= SectorAddress[sector] && Address < SectorAddress[sector + 1U])
+			return sector;
+
+	return BFLASH_NO_SECTOR;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Bytes from an address to the end of its sector
+ * @param   Address: flash address
+ * @retval  Number of bytes, 0 outside of the flash
+ */
+uint32_t BFLASH_SectorRemaining(uint32_t Address){
+
+	uint8_t sector = BFLASH_SectorOf(Address);
+
+	if (sector == BFLASH_NO_SECTOR)
+		return 0;
+
+	return SectorAddress[sector + 1U] - Address;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Start a program session
+ * @note	Called on flash unlock, a background erase still running is completed first.
+ * @param   autoErase: 1 to erase the sectors on their first write
+ * @param   limit: end of the image, the sectors after it are kept as they are
+ * @retval  None
+ */
+void BFLASH_SessionStart(uint8_t autoErase, uint32_t limit){
+
+	BFLASH_Wait();
+
+	SessionErased = 0;
+	AutoErase = autoErase;
+	EraseLimit = limit;
+	LookaheadSector = BFLASH_NO_SECTOR;
+	memset(&WriteStats, 0, sizeof(WriteStats));
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Record sectors erased by an erase command
+ * @param   sector: first sector, nbSectors: number of sectors
+ * @retval  None
+ */
+void BFLASH_MarkErased(uint32_t sector, uint32_t nbSectors){
+
+	for (; nbSectors != 0U && sector < FLASH_SECTOR_TOTAL; --nbSectors, ++sector)
+		SessionErased |= (uint8_t)(1U << sector);
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Erase the sectors of an area not erased yet in the session
+ * @note	Does nothing without auto erase, see BFLASH_ERASE_AREA.
+ * @param   Address: start of the area to program, size: number of bytes
+ * @retval  HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
+ */
+HAL_StatusTypeDef BFLASH_Prepare(uint32_t Address, uint32_t size){
+
+	if (!AutoErase)
+		return HAL_OK;
+
+	return BFLASH_ERASE_AREA(Address, size);
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Erase the sectors of an area that can't take the data as they are
+ * @note	A sector is only erased when a word of the area inside it is neither erased
+ * 			nor identical to its data, whatever the auto erase. A copy over an identical or
+ * 			blank destination erases nothing, BFLASH_Program then skips the identical words.
+ * 			The data of an erased sector outside of the area is lost.
+ * 			The sectors holding the bootloader or the metadata are never erased (reported as WRPERR).
+ * @param   Address: flash address (word aligned), pData: data, size: number of bytes (multiple of 4)
+ * @retval  HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
+ */
+HAL_StatusTypeDef BFLASH_PrepareCopy(uint32_t Address, const uint8_t *pData, uint32_t size){
+
+	BFLASH_Wait();
+
+	while (size != 0U)
+	{
+		uint8_t sector = BFLASH_SectorOf(Address);
+
+		// outside of the flash, left to the programming to fail.
+		if (sector == BFLASH_NO_SECTOR)
+			return HAL_OK;
+
+		uint32_t length = SectorAddress[sector + 1U] - Address;
+		if (length > size)
+			length = size;
+
+		if (!(SessionErased & (1U << sector)) && !BFLASH_PROGRAMMABLE(Address, pData, length))
+		{
+			uint32_t SectorError;
+
+			if (BFLASH_IsReserved(sector))
+			{
+				pFlash.ErrorCode = HAL_FLASH_ERROR_WRP;
+				return HAL_ERROR;
+			}
+
+			if (BFLASH_EraseSectors(sector, 1U, &SectorError) != HAL_OK)
+				return HAL_ERROR;
+		}
+
+		Address += length;
+		pData += length;
+		size -= length;
+	}
+
+	return HAL_OK;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Erase and program an area in one burst
+ * @note	The sectors of the area not erased yet in the session are erased whatever
+ * 			the auto erase, then the area is programmed by BFLASH_Program.
+ * @param   Address: flash address (word aligned), pData: data, size: number of bytes (multiple of 4)
+ * @retval  HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
+ */
+HAL_StatusTypeDef BFLASH_Commit(uint32_t Address, const uint8_t *pData, uint32_t size){
+
+	if (BFLASH_ERASE_AREA(Address, size) != HAL_OK)
+		return HAL_ERROR;
+
+	return BFLASH_Program(Address, pData, size);
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Write any byte range through the coalescing buffer
+ * @note	A write continuing the bytes held is appended, any other write flushes them
+ * 			first. A full buffer is programmed at once, the bytes of a write are only
+ * 			certain to be in the flash after BFLASH_Flush. The flash must be unlocked, the
+ * 			sectors are prepared (auto erase) when the bytes are programmed.
+ * @param   Address: flash address, pData: data, size: number of bytes
+ * @retval  HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
+ */
+HAL_StatusTypeDef BFLASH_Write(uint32_t Address, const uint8_t *pData, uint32_t size){
+
+	if (size == 0U)
+		return HAL_OK;
+
+	if (CoalesceHead != CoalesceEnd && Address != CoalesceAddress + CoalesceEnd
+		&& BFLASH_Flush() != HAL_OK)
+		return HAL_ERROR;
+
+	if (CoalesceHead == CoalesceEnd)
+	{
+		CoalesceAddress = Address & ~0x3U;
+		CoalesceHead = CoalesceEnd = Address & 0x3U;
+	}
+
+	WriteStats.Writes++;
+	WriteStats.Bytes += size;
+
+	while (size != 0U)
+	{
+		uint32_t chunk = BFLASH_COALESCE_SIZE - CoalesceEnd;
+
+		if (chunk > size)
+			chunk = size;
+
+		memcpy(&CoalesceBuffer[CoalesceEnd], pData, chunk);
+		CoalesceEnd += chunk;
+		pData += chunk;
+		size -= chunk;
+
+		// full, the buffer ends on a word : no tail fragment, the next bytes start a new buffer.
+		if (CoalesceEnd == BFLASH_COALESCE_SIZE)
+		{
+			if (BFLASH_Flush() != HAL_OK)
+				return HAL_ERROR;
+
+			CoalesceAddress += BFLASH_COALESCE_SIZE;
+		}
+	}
+
+	return HAL_OK;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Program the bytes held by the write coalescing buffer
+ * @note	The buffer is emptied even on error, HAL_FLASH_GetError() reports the failure.
+ * @param   None
+ * @retval  HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
+ */
+HAL_StatusTypeDef BFLASH_Flush(void){
+
+	if (CoalesceHead == CoalesceEnd)
+		return HAL_OK;
+
+	HAL_StatusTypeDef status = BFLASH_COALESCE_PROGRAM();
+
+	CoalesceHead = CoalesceEnd = 0;
+
+	return status;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Write coalescing statistics
+ * @note	Restart with the program session.
+ * @param   None
+ * @retval  Statistics of the session
+ */
+const BFLASH_WriteStatsType *BFLASH_WriteStats(void){
+
+	return &WriteStats;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Complete the background erase once the flash is done
+ * @note	A failed background erase just leaves the sector not erased, its first
+ * 			write erases it again and reports the error.
+ * @param   None
+ * @retval  None
+ */
+void BFLASH_Poll(void){
+
+	if (ErasingSector == BFLASH_NO_SECTOR || (FLASH->SR & FLASH_SR_BSY) != 0U)
+		return;
+
+	CLEAR_BIT(FLASH->CR, (FLASH_CR_SER | FLASH_CR_SNB));
+
+	uint8_t sector = ErasingSector;
+	uint32_t errors = FLASH->SR & SR_ERRORS;
+
+	FLASH_FlushCaches();
+	ErasingSector = BFLASH_NO_SECTOR;
+
+	if (errors == 0U)
+	{
+		SessionErased |= (uint8_t)(1U << sector);
+		META_RecordErase(sector, BFLASH_ELAPSED_US(EraseStartCycle));
+	}
+	else
+		FLASH->SR = errors;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Wait for the background erase
+ * @param   None
+ * @retval  None
+ */
+void BFLASH_Wait(void){
+
+	while (ErasingSector != BFLASH_NO_SECTOR)
+		BFLASH_Poll();
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Start the background erase of the next sector
+ * @note	Must only be called while nothing is being programmed, the flash can't be
+ * 			programmed during an erase, BFLASH_Prepare waits for it.
+ * 			Single bank : the code fetches stall the CPU until the erase ends, only the
+ * 			DMA reception goes on, the caller starts it while the link is idle.
+ * @param   None
+ * @retval  None
+ */
+void BFLASH_Lookahead(void){
+
+	if (LookaheadSector == BFLASH_NO_SECTOR || ErasingSector != BFLASH_NO_SECTOR
+		|| (FLASH->SR & FLASH_SR_BSY) != 0U || (FLASH->CR & FLASH_CR_LOCK) != 0U)
+		return;
+
+	if (!(SessionErased & (1U << LookaheadSector)) && BFLASH_SectorBlank(LookaheadSector))
+		SessionErased |= (uint8_t)(1U << LookaheadSector);
+
+	if (!(SessionErased & (1U << LookaheadSector)) && !BFLASH_IsReserved(LookaheadSector))
+	{
+		FLASH->SR = SR_ERRORS;
+		EraseStartCycle = DWT->CYCCNT;
+		FLASH_Erase_Sector(LookaheadSector, FLASH_VOLTAGE_RANGE_3);
+		ErasingSector = LookaheadSector;
+	}
+
+	LookaheadSector = BFLASH_NO_SECTOR;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Programming loop, runs from RAM
+ * @note	Only inline code here, a call into the flash would stall until the end of
+ * 			the write. Interrupts are still served (from flash, so they wait for BSY).
+ * @param   pDest: flash destination, pSrc: data, count: number of words
+ * @retval  FLASH->SR error flags, zero on success
+ */
+static __RAM_FUNC uint32_t BFLASH_PROGRAM_WORDS(volatile uint32_t *pDest, const uint32_t *pSrc, uint32_t count){
+
+	uint32_t errors = 0;
+
+	while ((FLASH->SR & FLASH_SR_BSY) != 0U)
+	{
+		/* Waiting */
+	}
+	FLASH->SR = SR_ERRORS;
+
+	MODIFY_REG(FLASH->CR, FLASH_CR_PSIZE, FLASH_PSIZE_WORD);
+	SET_BIT(FLASH->CR, FLASH_CR_PG);
+
+	for (; count != 0U; --count, ++pDest, ++pSrc)
+	{
+		uint32_t word = *pSrc;
+
+		if (word == ERASED_WORD || word == *pDest)
+			continue;
+
+		*pDest = word;
+		__DSB();
+
+		while ((FLASH->SR & FLASH_SR_BSY) != 0U)
+		{
+			/* Waiting */
+		}
+
+		errors = FLASH->SR & SR_ERRORS;
+		if (errors != 0U)
+			break;
+	}
+
+	CLEAR_BIT(FLASH->CR, FLASH_CR_PG);
+
+	return errors;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Program one byte or halfword, runs from RAM
+ * @param   Address: flash address, data: value, psize: FLASH_PSIZE_BYTE or FLASH_PSIZE_HALF_WORD
+ * @retval  FLASH->SR error flags, zero on success
+ */
+static __RAM_FUNC uint32_t BFLASH_PROGRAM_UNIT(uint32_t Address, uint16_t data, uint32_t psize){
+
+	while ((FLASH->SR & FLASH_SR_BSY) != 0U)
+	{
+		/* Waiting */
+	}
+	FLASH->SR = SR_ERRORS;
+
+	MODIFY_REG(FLASH->CR, FLASH_CR_PSIZE, psize);
+	SET_BIT(FLASH->CR, FLASH_CR_PG);
+
+	if (psize == FLASH_PSIZE_BYTE)
+		*(volatile uint8_t*) Address = (uint8_t) data;
+	else
+		*(volatile uint16_t*) Address = data;
+	__DSB();
+
+	while ((FLASH->SR & FLASH_SR_BSY) != 0U)
+	{
+		/* Waiting */
+	}
+
+	CLEAR_BIT(FLASH->CR, FLASH_CR_PG);
+
+	return FLASH->SR & SR_ERRORS;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Program a fragment of a word (1 to 3 bytes)
+ * @note	A halfword on an even address, a byte otherwise. Erased bytes are skipped.
+ * @param   Address: flash address, pData: data, size: number of bytes
+ * @retval  HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
+ */
+static HAL_StatusTypeDef BFLASH_PROGRAM_FRAGMENT(uint32_t Address, const uint8_t *pData, uint32_t size){
+
+	while (size != 0U)
+	{
+		uint32_t errors = 0;
+		uint32_t step = ((Address & 0x1U) == 0U && size >= 2U) ? 2U : 1U;
+		uint16_t data = (step == 2U) ? (uint16_t)(pData[0] | (pData[1] << 8U)) : pData[0];
+
+		if (data != ((step == 2U) ? 0xFFFFU : 0xFFU))
+		{
+			errors = BFLASH_PROGRAM_UNIT(Address, data, (step == 2U) ? FLASH_PSIZE_HALF_WORD : FLASH_PSIZE_BYTE);
+			WriteStats.FragmentOps++;
+		}
+
+		if (errors != 0U)
+		{
+			BFLASH_SET_ERROR(errors);
+			return HAL_ERROR;
+		}
+
+		Address += step;
+		pData += step;
+		size -= step;
+	}
+
+	return HAL_OK;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Program the bytes held by the write coalescing buffer
+ * @note	[head fragment][whole words][tail fragment], the fragments being the bytes
+ * 			of the first and last words not fully held.
+ * @param   None
+ * @retval  HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
+ */
+static HAL_StatusTypeDef BFLASH_COALESCE_PROGRAM(void){
+
+	uint32_t wordsStart = (CoalesceHead + 3U) & ~0x3U;
+	uint32_t wordsEnd = CoalesceEnd & ~0x3U;
+
+	pFlash.ErrorCode = HAL_FLASH_ERROR_NONE;
+
+	if (BFLASH_Prepare(CoalesceAddress + CoalesceHead, CoalesceEnd - CoalesceHead) != HAL_OK)
+		return HAL_ERROR;
+
+	// all the bytes inside a single word.
+	if (wordsStart > wordsEnd)
+		return BFLASH_PROGRAM_FRAGMENT(CoalesceAddress + CoalesceHead, &CoalesceBuffer[CoalesceHead], CoalesceEnd - CoalesceHead);
+
+	if (BFLASH_PROGRAM_FRAGMENT(CoalesceAddress + CoalesceHead, &CoalesceBuffer[CoalesceHead], wordsStart - CoalesceHead) != HAL_OK)
+		return HAL_ERROR;
+
+	if (wordsEnd > wordsStart)
+	{
+		if (BFLASH_Program(CoalesceAddress + wordsStart, &CoalesceBuffer[wordsStart], wordsEnd - wordsStart) != HAL_OK)
+			return HAL_ERROR;
+
+		WriteStats.WordOps += (wordsEnd - wordsStart) >> 2U;
+	}
+
+	return BFLASH_PROGRAM_FRAGMENT(CoalesceAddress + wordsEnd, &CoalesceBuffer[wordsEnd], CoalesceEnd - wordsEnd);
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Erase the sectors of an area not erased yet in the session
+ * @note	Waits for the background erase, erases the untouched sectors of the area
+ * 			and picks the following sector for the lookahead.
+ * 			The sectors holding the bootloader or the metadata are never erased (reported as WRPERR).
+ * @param   Address: start of the area to program, size: number of bytes
+ * @retval  HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
+ */
+static HAL_StatusTypeDef BFLASH_ERASE_AREA(uint32_t Address, uint32_t size){
+
+	if (size == 0U)
+		return HAL_OK;
+
+	BFLASH_Wait();
+
+	uint8_t first = BFLASH_SectorOf(Address);
+	uint8_t last = BFLASH_SectorOf(Address + size - 1U);
+
+	// outside of the flash, left to the programming to fail.
+	if (first == BFLASH_NO_SECTOR || last == BFLASH_NO_SECTOR)
+		return HAL_OK;
+
+	for (uint8_t sector = first; sector <= last; ++sector)
+	{
+		if (SessionErased & (1U << sector))
+			continue;
+
+		if (BFLASH_IsReserved(sector))
+		{
+			pFlash.ErrorCode = HAL_FLASH_ERROR_WRP;
+			return HAL_ERROR;
+		}
+
+		uint32_t SectorError;
+
+		if (BFLASH_EraseSectors(sector, 1U, &SectorError) != HAL_OK)
+			return HAL_ERROR;
+	}
+
+	if (last + 1U < FLASH_SECTOR_TOTAL && SectorAddress[last + 1U] < EraseLimit
+		&& !(SessionErased & (1U << (last + 1U))))
+		LookaheadSector = last + 1U;
+
+	return HAL_OK;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Check that an area can be programmed with some data without an erase
+ * @param   Address: flash address (word aligned), pData: data, size: number of bytes (multiple of 4)
+ * @retval  1 when every word is erased or already holds its data
+ */
+static uint8_t BFLASH_PROGRAMMABLE(uint32_t Address, const uint8_t *pData, uint32_t size){
+
+	const uint32_t *pDest = (const uint32_t*) Address;
+	const uint32_t *pSrc = (const uint32_t*) pData;
+
+	for (uint32_t count = size >> 2U; count != 0U; --count, ++pDest, ++pSrc)
+		if (*pDest != ERASED_WORD && *pDest != *pSrc)
+			return 0;
+
+	return 1;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Number of sectors holding the bootloader (code and initialized data)
+ * @param   None
+ * @retval  First sector free for the applications
+ */
+static uint8_t BFLASH_BOOT_SECTORS(void){
+
+	uint32_t bootEnd = (uint32_t)&_sidata + ((uint32_t)&_edata - (uint32_t)&_sdata);
+
+	return BFLASH_SectorOf(bootEnd - 1U) + 1U;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Sectors the program and erase paths never erase
+ * @param   sector: sector number
+ * @retval  1 for the bootloader sectors and the metadata sector
+ */
+uint8_t BFLASH_IsReserved(uint8_t sector){
+
+	return sector < BFLASH_BOOT_SECTORS() || sector == META_SECTOR;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Microseconds elapsed since a DWT cycle count
+ * @note	The cycle counter keeps counting while the CPU stalls on the flash.
+ * @param   startCycle: DWT->CYCCNT at the start
+ * @retval  microseconds
+ */
+static uint32_t BFLASH_ELAPSED_US(uint32_t startCycle){
+
+	return (DWT->CYCCNT - startCycle) / (SystemCoreClock / 1000000U);
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Report FLASH->SR error flags through HAL_FLASH_GetError() and clear them
+ * @param   errors: FLASH->SR error flags
+ * @retval  None
+ */
+static void BFLASH_SET_ERROR(uint32_t errors){
+
+	if (errors & FLASH_SR_WRPERR)
+		pFlash.ErrorCode |= HAL_FLASH_ERROR_WRP;
+	if (errors & FLASH_SR_PGAERR)
+		pFlash.ErrorCode |= HAL_FLASH_ERROR_PGA;
+	if (errors & FLASH_SR_PGPERR)
+		pFlash.ErrorCode |= HAL_FLASH_ERROR_PGP;
+	if (errors & FLASH_SR_PGSERR)
+		pFlash.ErrorCode |= HAL_FLASH_ERROR_PGS;
+	if (errors & FLASH_SR_RDERR)
+		pFlash.ErrorCode |= HAL_FLASH_ERROR_RD;
+	if (errors & FLASH_SR_SOP)
+		pFlash.ErrorCode |= HAL_FLASH_ERROR_OPERATION;
+
+	FLASH->SR = errors;
+}
+
+
+/**
+ * @}
+ */
+/**
+ * @}
+ */
@@ -0,0 +1,144 @@
+/*******************************************************************************
+ * @file    boot_lz4.c
+ * @author  Mohammed Khaled
+ * @email   Mohammed.kh384@gmail.com
+ * @website EMSTutorials.blogspot.com/
+ * @Created on: Mar 19, 2023
+ *
+ * @brief   this source file contains the implementation of the LZ4 block decoder.
+ * @note	A block is a list of sequences [token][literals length][literals][offset]
+ * 			[match length], the last sequence has literals only. Matches copy from
+ * 			the data already decoded, so the whole block is decoded in the RAM window.
+ *
+@verbatim
+Copyright (C) EMSTutorials, 2019
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+@endverbatim
+*******************************************************************************/
+
+/**************** Includes ********************/
+#include "boot_lz4.h"
+
+
+/**
+ * @defgroup  private local defines
+ * @brief
+ * @{
+ */
+
+#define 	MIN_MATCH				4U
+#define 	RUN_MASK				0x0FU
+
+/**
+  * @}
+  */
+
+/**
+ * @defgroup  private local functions
+ * @brief
+ * @{
+ */
+
+static uint8_t LZ4_LENGTH(const uint8_t **ppSrc, const uint8_t *pEnd, uint32_t *pLength);
+
+/**
+* @}
+*/
+
+
+/**
+ * @brief	Decode one LZ4 block
+ * @note	Every read and write is bounds checked, a corrupted block never writes
+ * 			outside of pDst[0 .. dstCap - 1].
+ * @param   pSrc: compressed block, srcLen: its length,
+ * 			pDst: RAM window, dstCap: size of the window
+ * @retval  Decoded length, -1 on error
+ */
+int32_t LZ4_DecodeBlock(const uint8_t *pSrc, uint32_t srcLen, uint8_t *pDst, uint32_t dstCap){
+
+	const uint8_t *pEnd = pSrc + srcLen;
+	uint32_t out = 0;
+
+	while (pSrc < pEnd)
+	{
+		uint8_t token = *pSrc++;
+		uint32_t length = token >> 4U;
+
+		/* Literals */
+		if (length == RUN_MASK && !LZ4_LENGTH(&pSrc, pEnd, &length))
+			return -1;
+		if (length > (uint32_t)(pEnd - pSrc) || length > dstCap - out)
+			return -1;
+
+		for (uint32_t idx = 0; idx < length; ++idx)
+			pDst[out++] = *pSrc++;
+
+		/* The last sequence ends after its literals */
+		if (pSrc == pEnd)
+			break;
+
+		/* Match */
+		if ((uint32_t)(pEnd - pSrc) < 2U)
+			return -1;
+		uint32_t offset = pSrc[0] | ((uint32_t)pSrc[1] << 8U);
+		pSrc += 2;
+		if (offset == 0U || offset > out)
+			return -1;
+
+		length = token & RUN_MASK;
+		if (length == RUN_MASK && !LZ4_LENGTH(&pSrc, pEnd, &length))
+			return -1;
+		length += MIN_MATCH;
+		if (length > dstCap - out)
+			return -1;
+
+		// byte by byte, the match may overlap the bytes it produces.
+		for (uint32_t idx = 0; idx < length; ++idx, ++out)
+			pDst[out] = pDst[out - offset];
+	}
+
+	return (int32_t)out;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Add the extension bytes of a length field (255 means another byte follows)
+ * @param   ppSrc: read pointer, advanced, pEnd: end of the block, pLength: length to extend
+ * @retval  1 on success, 0 if the block ends inside the length
+ */
+static uint8_t LZ4_LENGTH(const uint8_t **ppSrc, const uint8_t *pEnd, uint32_t *pLength){
+
+	uint8_t byte;
+
+	do
+	{
+		if (*ppSrc >= pEnd)
+			return 0;
+		byte = *(*ppSrc)++;
+		*pLength += byte;
+	} while (byte == 0xFFU);
+
+	return 1;
+}
+
+
+/**
+ * @}
+ */
+/**
+ * @}
+ */
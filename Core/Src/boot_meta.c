@@ -0,0 +1,624 @@
+/*******************************************************************************
+ * @file    boot_meta.c
+ * @author  Mohammed Khaled
+ * @email   Mohammed.kh384@gmail.com
+ * @website EMSTutorials.blogspot.com/
+ * @Created on: Apr 4, 2023
+ *
+ * @brief   this source file contains the implementation of the bootloader metadata log.
+ * @note	A record is [DATA 0][DATA 1][DATA 2][HEADER], programmed in this order so a
+ * 			record torn by a reset has no valid header and is ignored. The header holds
+ * 			the tag, the key and a check of the data. The log is the records from the
+ * 			start of the sector up to the first blank one, the latest record of a tag and
+ * 			key is the valid one. A full log is compacted : the latest records are kept
+ * 			in RAM, the sector is erased and they are programmed again.
+ * 			The latest record of every tag and key is indexed in RAM when the log is
+ * 			scanned and when a record is appended, a read doesn't scan the log.
+ * 			The slot states and the boot settings drive the boot, so during a compaction
+ * 			they are also saved in the RTC backup registers : a reset before it completes
+ * 			writes them again at the next start (META_Init). A power loss also clears the
+ * 			backup domain (no VBAT supply), the slots then rebuild their states from the
+ * 			image headers (BOOT_SLOTS_UPDATE). The other records are a cache, the update
+ * 			journal and the wear telemetry, lost with the log.
+ *
+@verbatim
+Copyright (C) EMSTutorials, 2019
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+@endverbatim
+*******************************************************************************/
+
+/**************** Includes ********************/
+#include "boot_meta.h"
+#include "boot_flash.h"
+#include <string.h>
+
+
+/**
+ * @defgroup  private local defines
+ * @brief
+ * @{
+ */
+
+#define 	ERASED_WORD				(0xFFFFFFFFU)
+#define 	HEADER_WORD				(META_DATA_WORDS)		// word of the header in a record.
+#define 	RECORD_WORDS			(META_RECORD_SIZE >> 2U)
+#define 	META_END				(META_ADDRESS + META_SIZE)
+#define 	TIME_MAX				(0xFFFFU)				// ms, erase times saturate.
+
+// Records saved by a compaction : META_SAVE_MAX records in the RTC backup registers from
+// SAVE_FIRST on, then [SAVE_MAGIC | records] in SAVE_FLAG while the sector is rewritten.
+#define 	BKP_REGISTER(idx)		((&RTC->BKP0R)[idx])
+#define 	SAVE_FIRST				(6U)					// BKP0R to BKP5R are used by the boot control.
+#define 	SAVE_FLAG				(SAVE_FIRST + META_SAVE_MAX * RECORD_WORDS)
+#define 	SAVE_MAGIC				(0x4D430000U)			// "CM"
+#define 	SAVE_MAGIC_MASK			(0xFFFF0000U)
+
+// WEAR record data : [COUNT][SEQUENCE][LAST ms | FIRST ms << 16]
+#define 	WEAR_COUNT				(0U)
+#define 	WEAR_SEQUENCE			(1U)
+#define 	WEAR_TIMES				(2U)
+
+/**
+  * @}
+  */
+
+
+/**
+ * @defgroup  private local variables
+ * @brief
+ * @{
+ */
+
+static uint32_t LogEnd = META_END;				// first blank record, META_END when the log is full.
+static uint32_t EraseSequence;					// sequence number of the last erase recorded.
+static uint32_t Kept[META_KEEP_MAX][RECORD_WORDS];	// records kept by a compaction.
+static uint32_t Index[META_KEEP_MAX];			// address of the latest record of every tag and key.
+static uint32_t IndexCount;
+static uint8_t IndexFull;						// more tags and keys than indexed, the reads scan the log.
+
+/**
+  * @}
+  */
+
+
+/**
+ * @defgroup  private local functions
+ * @brief
+ * @{
+ */
+
+static uint32_t META_HEADER(uint8_t tag, uint8_t key, const uint32_t *pData);
+static uint8_t META_VALID(const uint32_t *pRecord);
+static HAL_StatusTypeDef META_PROGRAM(const uint32_t *pRecord);
+static HAL_StatusTypeDef META_COMPACT(void);
+static void META_WEAR_UPDATE(uint32_t *pData, uint32_t durationUs);
+static void META_SAVE(uint32_t count);
+static void META_RESTORE(void);
+static void META_BKP_WRITE(uint32_t idx, uint32_t value);
+static void META_INDEX_BUILD(void);
+static void META_INDEX(uint32_t address);
+
+/**
+  * @}
+  */
+
+
+/**
+ * @brief	Find the end of the log
+ * @note	Also indexes the latest records, restores the erase sequence from the WEAR
+ * 			records, and the records saved by a compaction a reset interrupted.
+ * @param   None
+ * @retval  None
+ */
+void META_Init(void){
+
+	LogEnd = META_END;
+	META_INDEX_BUILD();
+
+	if ((BKP_REGISTER(SAVE_FLAG) & SAVE_MAGIC_MASK) == SAVE_MAGIC)
+		META_RESTORE();
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Data of the latest record of a tag and key
+ * @note	Looked up in the index, the log is only scanned when it holds more tags and
+ * 			keys than META_KEEP_MAX (until its next compaction).
+ * @param   tag: record tag, key: record key, pData: META_DATA_WORDS words
+ * @retval  HAL_StatusTypeDef {HAL_OK, or HAL_ERROR when there is no such record}
+ */
+HAL_StatusTypeDef META_Read(uint8_t tag, uint8_t key, uint32_t *pData){
+
+	uint16_t id = (uint16_t)(tag | (key << 8U));
+	const uint32_t *pFound = NULL;
+
+	for (uint32_t idx = 0; idx < IndexCount; ++idx)
+	{
+		if ((uint16_t)((const uint32_t*) Index[idx])[HEADER_WORD] == id)
+		{
+			pFound = (const uint32_t*) Index[idx];
+			break;
+		}
+	}
+
+	if (pFound == NULL && IndexFull)
+	{
+		for (uint32_t address = META_ADDRESS; address < LogEnd; address += META_RECORD_SIZE)
+		{
+			const uint32_t *pRecord = (const uint32_t*) address;
+
+			if (META_VALID(pRecord) && (uint16_t)pRecord[HEADER_WORD] == id)
+				pFound = pRecord;
+		}
+	}
+
+	if (pFound == NULL)
+		return HAL_ERROR;
+
+	memcpy(pData, pFound, META_DATA_WORDS << 2U);
+
+	return HAL_OK;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Append a record
+ * @note	The log is compacted first when full. The flash is unlocked for the write and
+ * 			locked again if it was locked, a background erase is completed first.
+ * @param   tag: record tag, key: record key, pData: META_DATA_WORDS words
+ * @retval  HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
+ */
+HAL_StatusTypeDef META_Write(uint8_t tag, uint8_t key, const uint32_t *pData){
+
+	uint32_t record[RECORD_WORDS];
+	uint8_t locked = (FLASH->CR & FLASH_CR_LOCK) != 0U;
+	HAL_StatusTypeDef status = HAL_OK;
+
+	memcpy(record, pData, META_DATA_WORDS << 2U);
+	record[HEADER_WORD] = META_HEADER(tag, key, pData);
+
+	BFLASH_Wait();
+
+	if (locked && HAL_FLASH_Unlock() != HAL_OK)
+		return HAL_ERROR;
+
+	if (LogEnd >= META_END)
+		status = META_COMPACT();
+
+	if (status == HAL_OK)
+		status = META_PROGRAM(record);
+
+	if (locked)
+		HAL_FLASH_Lock();
+
+	return status;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Account an erase of a sector
+ * @note	Called for every sector erased by the sector and mass erase jobs, the auto and lookahead
+ * 			erases. An erase of the metadata sector itself restarts the log.
+ * @param   sector: sector erased, durationUs: erase time
+ * @retval  None
+ */
+void META_RecordErase(uint8_t sector, uint32_t durationUs){
+
+	uint32_t data[META_DATA_WORDS] = { 0, 0, 0 };
+
+	if (sector == META_SECTOR)
+		META_Init();
+	else
+		META_Read(META_TAG_WEAR, sector, data);
+
+	META_WEAR_UPDATE(data, durationUs);
+	META_Write(META_TAG_WEAR, sector, data);
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Wear of a sector
+ * @param   sector: sector number, pWear: wear of the sector, zero when never erased
+ * @retval  None
+ */
+void META_GetWear(uint8_t sector, META_WearType *pWear){
+
+	uint32_t data[META_DATA_WORDS] = { 0, 0, 0 };
+
+	META_Read(META_TAG_WEAR, sector, data);
+
+	pWear->Count = data[WEAR_COUNT];
+	pWear->Sequence = data[WEAR_SEQUENCE];
+	pWear->LastTime = (uint16_t) data[WEAR_TIMES];
+	pWear->FirstTime = (uint16_t)(data[WEAR_TIMES] >> 16U);
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Header of a record
+ * @note	[TAG][KEY][CHECK (16 bits)], the check folds the data words so a header
+ * 			programmed over other data is not taken as valid.
+ * @param   tag: record tag, key: record key, pData: META_DATA_WORDS words
+ * @retval  Header word
+ */
+static uint32_t META_HEADER(uint8_t tag, uint8_t key, const uint32_t *pData){
+
+	uint32_t check = pData[0] ^ pData[1] ^ pData[2] ^ 0x5AA5C33CU;
+
+	check = (check ^ (check >> 16U)) & 0xFFFFU;
+
+	return tag | ((uint32_t)key << 8U) | (check << 16U);
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Check a record
+ * @param   pRecord: record in the log
+ * @retval  1 when the header is valid for the data
+ */
+static uint8_t META_VALID(const uint32_t *pRecord){
+
+	uint8_t tag = (uint8_t) pRecord[HEADER_WORD];
+
+	if (tag == 0x00U || tag == 0xFFU)
+		return 0;
+
+	return pRecord[HEADER_WORD] == META_HEADER(tag, (uint8_t)(pRecord[HEADER_WORD] >> 8U), pRecord);
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Program a record at the end of the log
+ * @note	The record is consumed even when its programming fails, a torn record is ignored.
+ * 			A record programmed is indexed as the latest of its tag and key.
+ * @param   pRecord: record (header included)
+ * @retval  HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
+ */
+static HAL_StatusTypeDef META_PROGRAM(const uint32_t *pRecord){
+
+	uint32_t address = LogEnd;
+
+	LogEnd += META_RECORD_SIZE;
+
+	if (BFLASH_Program(address, (const uint8_t*) pRecord, META_RECORD_SIZE) != HAL_OK)
+		return HAL_ERROR;
+
+	if (META_VALID((const uint32_t*) address))
+		META_INDEX(address);
+
+	return HAL_OK;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Compact the log
+ * @note	Keeps the latest record of every tag and key (up to META_KEEP_MAX, the others
+ * 			are dropped), erases the sector, accounts that erase in its WEAR record and
+ * 			programs the records kept, which indexes them again. A failed erase indexes
+ * 			what is left of the log and leaves it full. The slot and boot records are saved in the backup
+ * 			registers until the records kept are programmed. The flash must be unlocked.
+ * @param   None
+ * @retval  HAL_StatusTypeDef {HAL_OK or HAL_ERROR}
+ */
+static HAL_StatusTypeDef META_COMPACT(void){
+
+	uint32_t count = 0;
+	uint32_t self = META_KEEP_MAX;
+
+	for (uint32_t address = META_ADDRESS; address < LogEnd; address += META_RECORD_SIZE)
+	{
+		const uint32_t *pRecord = (const uint32_t*) address;
+		uint32_t idx;
+
+		if (!META_VALID(pRecord))
+			continue;
+
+		for (idx = 0; idx < count; ++idx)
+			if ((uint16_t)Kept[idx][HEADER_WORD] == (uint16_t)pRecord[HEADER_WORD])
+				break;
+
+		if (idx < META_KEEP_MAX)
+		{
+			memcpy(Kept[idx], pRecord, META_RECORD_SIZE);
+			if (idx == count)
+				count++;
+		}
+	}
+
+	for (uint32_t idx = 0; idx < count; ++idx)
+		if ((uint16_t)Kept[idx][HEADER_WORD] == (uint16_t)(META_TAG_WEAR | (META_SECTOR << 8U)))
+			self = idx;
+
+	if (self == META_KEEP_MAX && count < META_KEEP_MAX)
+	{
+		memset(Kept[count], 0, META_RECORD_SIZE);
+		self = count++;
+	}
+
+	META_SAVE(count);
+
+	FLASH_EraseInitTypeDef strInit;
+	uint32_t SectorError;
+
+	strInit.Banks = FLASH_BANK_1;
+	strInit.Sector = META_SECTOR;
+	strInit.NbSectors = 1;
+	strInit.TypeErase = FLASH_TYPEERASE_SECTORS;
+	strInit.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+
+	uint32_t startCycle = DWT->CYCCNT;
+	HAL_StatusTypeDef status = HAL_FLASHEx_Erase(&strInit, &SectorError);
+	uint32_t durationUs = (DWT->CYCCNT - startCycle) / (SystemCoreClock / 1000000U);
+
+	// a failed erase leaves the flag set, the next start checks the log.
+	if (status != HAL_OK)
+	{
+		LogEnd = META_END;
+		META_INDEX_BUILD();
+		LogEnd = META_END;
+		return HAL_ERROR;
+	}
+
+	LogEnd = META_ADDRESS;
+	IndexCount = 0;
+	IndexFull = 0;
+
+	if (self < META_KEEP_MAX)
+	{
+		META_WEAR_UPDATE(Kept[self], durationUs);
+		Kept[self][HEADER_WORD] = META_HEADER(META_TAG_WEAR, META_SECTOR, Kept[self]);
+	}
+
+	for (uint32_t idx = 0; idx < count; ++idx)
+		META_PROGRAM(Kept[idx]);
+
+	META_BKP_WRITE(SAVE_FLAG, 0);
+
+	return HAL_OK;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Account an erase in the data of a WEAR record
+ * @param   pData: WEAR record data (zero for a new record), durationUs: erase time
+ * @retval  None
+ */
+static void META_WEAR_UPDATE(uint32_t *pData, uint32_t durationUs){
+
+	uint32_t time = durationUs / 1000U;
+
+	if (time > TIME_MAX)
+		time = TIME_MAX;
+
+	// the first erase time is kept as the reference.
+	if (pData[WEAR_COUNT] == 0U)
+		pData[WEAR_TIMES] = time << 16U;
+
+	pData[WEAR_COUNT]++;
+	pData[WEAR_SEQUENCE] = ++EraseSequence;
+	pData[WEAR_TIMES] = (pData[WEAR_TIMES] & 0xFFFF0000U) | time;
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Save the slot and boot records kept by a compaction in the backup registers
+ * @note	The records first, the flag last : a flag without its records is never seen.
+ * @param   count: records in Kept
+ * @retval  None
+ */
+static void META_SAVE(uint32_t count){
+
+	uint32_t saved = 0;
+
+	for (uint32_t idx = 0; idx < count && saved < META_SAVE_MAX; ++idx)
+	{
+		uint8_t tag = (uint8_t) Kept[idx][HEADER_WORD];
+
+		if (tag != META_TAG_SLOT && tag != META_TAG_BOOT)
+			continue;
+
+		for (uint32_t word = 0; word < RECORD_WORDS; ++word)
+			META_BKP_WRITE(SAVE_FIRST + saved * RECORD_WORDS + word, Kept[idx][word]);
+		saved++;
+	}
+
+	META_BKP_WRITE(SAVE_FLAG, SAVE_MAGIC | saved);
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Write again the records saved by a compaction a reset interrupted
+ * @note	The log holds the records the compaction programmed before the reset (none
+ * 			when it wasn't erased yet, or all of them), a saved record missing from it
+ * 			is appended. The flag is cleared once they are all in the log. They are copied
+ * 			first, an append compacting the log saves its own records.
+ * @param   None
+ * @retval  None
+ */
+static void META_RESTORE(void){
+
+	uint32_t saved = BKP_REGISTER(SAVE_FLAG) & ~SAVE_MAGIC_MASK;
+	uint32_t records[META_SAVE_MAX][RECORD_WORDS];
+	uint32_t data[META_DATA_WORDS];
+
+	if (saved > META_SAVE_MAX)
+		saved = 0;
+
+	for (uint32_t idx = 0; idx < saved; ++idx)
+		for (uint32_t word = 0; word < RECORD_WORDS; ++word)
+			records[idx][word] = BKP_REGISTER(SAVE_FIRST + idx * RECORD_WORDS + word);
+
+	for (uint32_t idx = 0; idx < saved; ++idx)
+	{
+		uint8_t tag = (uint8_t) records[idx][HEADER_WORD];
+		uint8_t key = (uint8_t)(records[idx][HEADER_WORD] >> 8U);
+
+		if (!META_VALID(records[idx]))
+			continue;
+
+		if (META_Read(tag, key, data) == HAL_OK && memcmp(data, records[idx], META_DATA_WORDS << 2U) == 0)
+			continue;
+
+		if (META_Write(tag, key, records[idx]) != HAL_OK)
+			return;
+	}
+
+	META_BKP_WRITE(SAVE_FLAG, 0);
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Write an RTC backup register
+ * @note	Same as the boot control : the backup domain is write protected again and the
+ * 			PWR clock left as it was (the log is also written before the clock setup).
+ * @param   idx: backup register number, value: value to write
+ * @retval  None
+ */
+static void META_BKP_WRITE(uint32_t idx, uint32_t value){
+
+	uint32_t pwrClock = __HAL_RCC_PWR_IS_CLK_ENABLED();
+
+	__HAL_RCC_PWR_CLK_ENABLE();
+	HAL_PWR_EnableBkUpAccess();
+
+	BKP_REGISTER(idx) = value;
+
+	HAL_PWR_DisableBkUpAccess();
+	if (!pwrClock)
+		__HAL_RCC_PWR_CLK_DISABLE();
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Scan the log
+ * @note	Indexes the latest record of every tag and key and restores the erase sequence
+ * 			from the WEAR records, up to the first blank record which ends the log.
+ * @param   None
+ * @retval  None
+ */
+static void META_INDEX_BUILD(void){
+
+	IndexCount = 0;
+	IndexFull = 0;
+
+	for (uint32_t address = META_ADDRESS; address < META_END; address += META_RECORD_SIZE)
+	{
+		const uint32_t *pRecord = (const uint32_t*) address;
+
+		if ((pRecord[0] & pRecord[1] & pRecord[2] & pRecord[3]) == ERASED_WORD)
+		{
+			LogEnd = address;
+			break;
+		}
+
+		if (!META_VALID(pRecord))
+			continue;
+
+		META_INDEX(address);
+
+		if ((uint8_t)pRecord[HEADER_WORD] == META_TAG_WEAR
+			&& (int32_t)(pRecord[WEAR_SEQUENCE] - EraseSequence) > 0)
+			EraseSequence = pRecord[WEAR_SEQUENCE];
+	}
+}
+
+
+/**
+ * @}
+ */
+
+/**
+ * @brief	Index a valid record as the latest of its tag and key
+ * @note	A tag and key beyond META_KEEP_MAX isn't indexed, the reads of the missing
+ * 			ones then scan the log.
+ * @param   address: record in the log
+ * @retval  None
+ */
+static void META_INDEX(uint32_t address){
+
+	uint16_t id = (uint16_t)((const uint32_t*) address)[HEADER_WORD];
+
+	for (uint32_t idx = 0; idx < IndexCount; ++idx)
+	{
+		if ((uint16_t)((const uint32_t*) Index[idx])[HEADER_WORD] == id)
+		{
+			Index[idx] = address;
+			return;
+		}
+	}
+
+	if (IndexCount < META_KEEP_MAX)
+		Index[IndexCount++] = address;
+	else
+		IndexFull = 1;
+}
+
+
+/**
+ * @}
+ */
+/**
+ * @}
+ */
@@ -60,6 +60,18 @@ defined in linker script */
 Reset_Handler:  
   ldr   sp, =_estack      /* set stack pointer */
 
+/* Start the DWT cycle counter from zero, the boot latency is measured from here. */
+  ldr   r0, =0xE000EDFC   /* CoreDebug->DEMCR */
+  ldr   r1, [r0]
+  orr   r1, r1, #0x01000000   /* TRCENA */
+  str   r1, [r0]
+  ldr   r0, =0xE0001000   /* DWT->CTRL */
+  movs  r1, #0
+  str   r1, [r0, #4]      /* DWT->CYCCNT */
+  ldr   r1, [r0]
+  orr   r1, r1, #1        /* CYCCNTENA */
+  str   r1, [r0]
+
 /* Copy the data segment initializers from flash to SRAM */  
   ldr r0, =_sdata
   ldr r1, =_edata
@@ -93,6 +105,8 @@ LoopFillZerobss:
 
 /* Call the clock system initialization function.*/
   bl  SystemInit   
+/* Boot the application at once unless the bootloader is needed (boot_cntrl.c).*/
+  bl  BOOT_EARLY_DECISION
 /* Call static constructors */
     bl __libc_init_array
 /* Call the application's entry point.*/
@@ -1,17 +1,14 @@
 from __future__ import print_function
 
 import argparse
-from contextlib import redirect_stderr
-from time import sleep
+import os
+import sys
+import time
 
 import serial
 import struct
-from progressbar import progressbar
 from progress.bar import Bar
 
-import sys
-
-from fontTools.afmLib import error
 from intelhex import IntelHex
 
 COMMANDS = {
@@ -28,11 +25,34 @@ COMMANDS = {
     'OB_LOCK': 0x0A,
     'OB_READ': 0x0B,
     'WR_PROTECT': 0x0C,
-    'WR_UNPROTECT': 0x0D
+    'WR_UNPROTECT': 0x0D,
+    'CRC_CHECK': 0x10,
+    'FLASH_PROGRAM_WIN': 0x11,
+    'FLASH_PROGRAM_EXT': 0x12,
+    'SET_BAUD': 0x13,
+    'STATS': 0x14,
+    'FLASH_PROGRAM_LZ4': 0x15,
+    'FLASH_DELTA': 0x16,
+    'STAGING': 0x1C,
+    'FLASH_WRITE': 0x1D,
+    'BLOCK_CRC': 0x17,
+    'FLASH_BENCH': 0x18,
+    'AUTO_ERASE': 0x19,
+    'BLANK_CHECK': 0x1A,
+    'ERASE_STATUS': 0x1B,
+    'WEAR': 0x1E,
+    'BOOT_WINDOW': 0x1F,
+    'IMAGE_INFO': 0x20,
+    'SLOT': 0x21,
+    'JOURNAL': 0x22,
+    'RAM_WRITE': 0x23,
+    'RAM_EXEC': 0x24,
+    'APPLET': 0x25
 }
 
 ACK = 0x41
 NACK = 0x4E
+PROGRESS = 0x50
 
 ERRORS = {
     0xE1: ' > Programming Sequence error.',
@@ -40,16 +60,258 @@ ERRORS = {
     0xE3: ' > Programming Alignment error.',
     0xE4: ' > Write protection error.',
     0xE5: ' > Read Protection error.',
-    0xE6: ' > Operation Error.'
+    0xE6: ' > Operation Error.',
+    0xE7: ' > Compressed block decoding error.',
+    0xE8: ' > Staging window error.',
+    0xE9: ' > RAM image outside of the RAM area or not valid.',
+    0xEA: ' > Baud rate not reachable by the bootloader.',
+    0xEB: ' > Flash locked, unlock it first.',
+    0xEC: ' > Sector reserved to the bootloader or its metadata log.',
+    0xED: ' > RAM area holding a RAM write, release it first.'
 }
 
 CMD_WRITE = 0x03
 
+# statistics selectors of the STATS command.
+STATS_PROG_STAGE = 0x00
+STATS_WRITE = 0x01
+STATS_BOOT = 0x02
+
+# host activity window of the auto-boot (ms), this value disables the auto-boot.
+BOOT_WINDOW_MAX = 10000
+BOOT_WINDOW_OFF = 0xFFFF
+# image header in front of the application : the header area, then the image (vector table).
+# Each slot starts with a header, an image is linked for its slot (header address + HEADER_SIZE).
+SLOTS = {'A': 0x08010000, 'B': 0x08020000}
+APP_ADDRESS = SLOTS['A']
+HEADER_MAGIC = 0x474D4942
+HEADER_SIZE = 0x200
+# states of the IMAGE_INFO reply.
+IMAGE_STATES = {0x00: 'no valid header', 0x01: 'header valid, CRC not verified', 0x02: 'verified'}
+# operations of the SLOT command and the slot states.
+SLOT_INFO = 0x00
+SLOT_CONFIRM = 0x01
+SLOT_STATES = {0x00: 'empty', 0x01: 'pending', 0x02: 'confirmed', 0x03: 'failed'}
+# byte skipped by the frame parser, sent while the board resets to keep it in the bootloader.
+WAKE_BYTE = 0xFF
+# update journal operations of the bootloader.
+JOURNAL_BEGIN = 0x00
+JOURNAL_QUERY = 0x01
+JOURNAL_CLEAR = 0x02
+# resumable write : sessions tried, reads without reply before the link is given up, and the
+# time spent sending wake bytes after reopening the port (the board may be resetting).
+RESUME_ATTEMPTS = 10
+RESUME_SILENCE = 5
+RESUME_WAKE = 2
+# RAM exec operations : the RAM area of the bootloader, the jump to a RAM image, and the
+# release of the area (staging and compressed frames are refused after a RAM write until then).
+RAM_AREA = 0x00
+RAM_RUN = 0x01
+RAM_RELEASE = 0x02
+# statuses of the flash applets (Core/Inc/boot_applet.h), and the longest call : an applet
+# may erase several sectors before it replies.
+APPLET_STATUS = {0x00: 'done', 0x01: 'arguments refused', 0x02: 'flash error', 0x03: 'malformed source data'}
+APPLET_TIMEOUT = 30
+
+BLOCK_SIZE = 16
+# frames kept in flight by the windowed program mode, WINDOW_SIZE * 22 bytes
+# must stay below the bootloader receive ring (COMM_RING_SIZE, 8192 bytes).
+WINDOW_SIZE = 16
+# time to wait for a cumulative ACK before going back to the oldest frame in flight.
+WINDOW_TIMEOUT = 1
+# same with the auto erase, a frame starting a new sector waits for the sector erase (128 KB : 2 s max).
+# The CPU of the bootloader stalls during a sector erase, this is also the longest reply delay.
+ERASE_TIMEOUT = 3
+# erase states of the ERASE_STATUS reply, and the polling period.
+ERASE_DONE = 0x00
+ERASE_BUSY = 0x01
+ERASE_FAILED = 0x02
+ERASE_POLL = 0.05
+# payload of the extended program frames, must not exceed the bootloader RX_PAYLOAD_SIZE.
+PAYLOAD_SIZE = 2048
+# extended frames in flight, must not exceed the bootloader RX_WINDOW_FRAMES : the ring (8192 bytes)
+# holds them all while the oldest one is programmed.
+EXT_WINDOW_SIZE = 2
+# decoded size of a compressed frame, must not exceed the bootloader LZ4_RAW_SIZE.
+RAW_SIZE = 4096
+# RAM staging window of the bootloader (STAGING_SIZE) and its operations.
+STAGING_SIZE = 16384
+STAGING_OPEN = 0x00
+STAGING_COMMIT = 0x01
+STAGING_ABORT = 0x02
+# delta operations, see makeDelta.
+DELTA_COPY = 0x01
+DELTA_INSERT = 0x02
+# shortest run of the installed image worth a copy operation (9 bytes on the link).
+DELTA_MIN_MATCH = 16
+# most bytes written by one delta frame, keeps its processing well below WINDOW_TIMEOUT.
+DELTA_MAX_SPAN = 16 * 1024
+# block size of the CRC manifest used by the incremental write.
+CRC_BLOCK_SIZE = 1024
+# STM32F401CC flash sectors (address, size).
+SECTORS = ((0x08000000, 0x4000), (0x08004000, 0x4000), (0x08008000, 0x4000), (0x0800C000, 0x4000),
+           (0x08010000, 0x10000), (0x08020000, 0x20000))
+# rated erase cycles of a sector, and the erase time growth reported as worn out.
+SECTOR_ENDURANCE = 10000
+WEAR_TIME_RATIO = 2.0
+# baud rates tried by probeBaudrate, fastest first (USART1 runs from the 84 MHz PCLK2).
+BAUD_RATES = (4000000, 3000000, 2000000, 1000000, 921600, 460800, 230400)
+# the set baud frame carries this pattern twice, a wrong sampling point corrupts it.
+BAUD_PATTERN = bytes([0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0, 0x33, 0xCC]) * 2
+# time the bootloader waits for the confirmation at the new rate before going back.
+BAUD_VERIFY_TIME = 0.5
+# time the bootloader waits for the next frame once the new rate is confirmed, then goes back.
+BAUD_KEEP_TIME = 1.0
+
 
 def toInt(byte):
     return struct.unpack('b', byte)[0]
 
 
+def lz4Compress(data):
+    # Compress `data` into one LZ4 block (greedy matching on 4 bytes hashes).
+    # Block rules kept for the decoder: the last 5 bytes are literals and the
+    # last match starts at least 12 bytes before the end.
+    data = bytes(data)
+    out = bytearray()
+
+    def writeLength(value):
+        while value >= 255:
+            out.append(255)
+            value -= 255
+        out.append(value)
+
+    def writeSequence(literals, offset=0, match=0):
+        token = min(len(literals), 15) << 4
+        if offset:
+            token |= min(match - 4, 15)
+        out.append(token)
+        if len(literals) >= 15:
+            writeLength(len(literals) - 15)
+        out.extend(literals)
+        if offset:
+            out.extend(struct.pack('<H', offset))
+            if match - 4 >= 15:
+                writeLength(match - 4 - 15)
+
+    table = {}
+    anchor = 0
+    i = 0
+    while i < len(data) - 12:
+        key = data[i:i + 4]
+        ref = table.get(key)
+        table[key] = i
+        if ref is None or i - ref > 0xFFFF:
+            i += 1
+            continue
+        length = 4
+        while i + length < len(data) - 5 and data[ref + length] == data[i + length]:
+            length += 1
+        writeSequence(data[anchor:i], i - ref, length)
+        i += length
+        anchor = i
+    writeSequence(data[anchor:])
+    return bytes(out)
+
+
+def _crcTable():
+    table = []
+    for byte in range(256):
+        crc = byte << 24
+        for bit in range(8):
+            crc = ((crc << 1) ^ 0x04C11DB7 if crc & 0x80000000 else crc << 1) & 0xFFFFFFFF
+        table.append(crc)
+    return table
+
+
+CRC_TABLE = _crcTable()
+
+
+def crc32Stm(data):
+    # CRC of the STM32 CRC unit (and of the bootloader CRC32_Compute): polynomial 0x04C11DB7,
+    # initial value 0xFFFFFFFF, little endian 32-bit words shifted in MSB first.
+    crc = 0xFFFFFFFF
+    for (word,) in struct.iter_unpack('<I', data):
+        crc ^= word
+        for i in range(4):
+            crc = ((crc << 8) & 0xFFFFFFFF) ^ CRC_TABLE[crc >> 24]
+    return crc
+
+
+def loadImage(filename):
+    # Returns (start address, image bytes) of a hex file, the gaps are filled with 0xFF
+    # and the image is padded to a whole word.
+    hex_file = IntelHex()
+    hex_file.loadhex(filename)
+    image = bytes(hex_file.tobinarray())
+    return hex_file.minaddr(), image + b'\xFF' * (-len(image) % 4)
+
+
+def imageEnd(filename):
+    # First address after the image of a hex file.
+    start, image = loadImage(filename)
+    return start + len(image)
+
+
+def addHeader(filename, version, header_address=APP_ADDRESS):
+    # Write a copy of the hex file with the image header in front of the image, which must
+    # start right after the header area. Returns the name of the new hex file.
+    start, image = loadImage(filename)
+    if start != header_address + HEADER_SIZE:
+        raise ValueError(f'the image must start at {hex(header_address + HEADER_SIZE)}, not {hex(start)}')
+    header = struct.pack('<6I', HEADER_MAGIC, version, start, len(image), start, crc32Stm(image))
+    out = IntelHex()
+    out.frombytes(header + b'\xFF' * (HEADER_SIZE - len(header)) + image, offset=header_address)
+    path = os.path.splitext(filename)[0] + '_header.hex'
+    out.write_hex_file(path)
+    return path
+
+
+def sectorsOf(address, size):
+    # Set of the sectors holding [address, address + size).
+    return {n for n, (base, length) in enumerate(SECTORS) if address < base + length and base < address + size}
+
+
+def makeDelta(old, old_address, new):
+    # Describe `new` as COPY runs of the installed image `old` (at `old_address`)
+    # and INSERT runs of new data, every run is a multiple of 4 bytes.
+    # Returns a list of (DELTA_COPY, source address, size) and (DELTA_INSERT, data).
+    index = {}
+    for offset in range(len(old) - DELTA_MIN_MATCH, -1, -1):
+        index[old[offset:offset + DELTA_MIN_MATCH]] = offset
+
+    ops = []
+    literal = bytearray()
+    shift = None  # source - destination of the last copy, tried first.
+    i = 0
+    while i < len(new):
+        key = new[i:i + DELTA_MIN_MATCH]
+        source = None
+        if len(key) == DELTA_MIN_MATCH:
+            if shift is not None and 0 <= i + shift and old[i + shift:i + shift + DELTA_MIN_MATCH] == key:
+                source = i + shift
+            else:
+                source = index.get(key)
+        if source is None:
+            literal += new[i:i + 4]
+            i += 4
+            continue
+
+        length = DELTA_MIN_MATCH
+        while (i + length < len(new) and length < DELTA_MAX_SPAN
+               and old[source + length:source + length + 4] == new[i + length:i + length + 4]):
+            length += 4
+        if literal:
+            ops.append((DELTA_INSERT, bytes(literal)))
+            literal = bytearray()
+        ops.append((DELTA_COPY, old_address + source, length))
+        shift = source - i
+        i += length
+    if literal:
+        ops.append((DELTA_INSERT, bytes(literal)))
+    return ops
+
+
 class ProgramModeError(Exception):
     pass
 
@@ -60,37 +322,71 @@ class TimeoutError(Exception):
 
 class STM32Flasher(object):
     def __init__(self, serialPort, baudrate=115200):
-        self.serial = serial.Serial(serialPort, baudrate=baudrate, timeout=30)
+        self.serial = serial.Serial(serialPort, baudrate=baudrate, timeout=ERASE_TIMEOUT)
+        # payload bytes sent by the last compressed write.
+        self.wireBytes = 0
 
-    def writeImage(self, filename):
-        # Sends an CMD_WRITE to the bootloader
-        # This is method is a generator, that returns its progresses to the caller.
-        # In this way, it's possible for the caller to live-print messages about
-        # writing progress
+    @staticmethod
+    def loadBlocks(filename, block_size=BLOCK_SIZE, trim=False):
+        # Split the populated ranges of the hex file (its segments) into (address, data) blocks
+        # aligned on block_size, the gaps between the segments are never sent.
+        # Bytes of a block missing from the file are padded with 0xFF, the erased value.
+        # With trim, a block is cut down to its populated words (variable length frames).
         hex_file = IntelHex()
         # load the hex file image.
         hex_file.loadhex(filename)
-
-        current_address = hex_file.minaddr()
-        MAX_ADDRESS = hex_file.maxaddr()
         file_content = hex_file.todict()
 
+        block_addresses = sorted({address - address % block_size
+                                  for start, end in hex_file.segments()
+                                  for address in range(start - start % block_size, end, block_size)})
+        blocks = []
+        for block_address in block_addresses:
+            addresses = range(block_address, block_address + block_size)
+            if trim:
+                populated = [address for address in addresses if address in file_content]
+                addresses = range(populated[0] & ~3, (populated[-1] + 4) & ~3)
+            blocks.append((addresses[0], [file_content.get(address, 0xFF) for address in addresses]))
+        return blocks
+
+    @staticmethod
+    def loadSegments(filename, chunk=PAYLOAD_SIZE):
+        # Split the populated ranges of the hex file into (address, data) chunks of up to
+        # `chunk` bytes, as they are: no alignment, no padding (write frames).
+        hex_file = IntelHex()
+        hex_file.loadhex(filename)
+        return [(address, bytes(hex_file.tobinarray(start=address, size=min(chunk, end - address))))
+                for start, end in hex_file.segments()
+                for address in range(start, end, chunk)]
+
+    @staticmethod
+    def wireReport(filename):
+        # Bytes of payload sent by the block and extended modes against the contiguous
+        # image from minaddr() to maxaddr() they used to send.
+        hex_file = IntelHex()
+        hex_file.loadhex(filename)
+        contiguous = hex_file.maxaddr() - hex_file.minaddr() + 1
+        yield f'{len(hex_file.segments())} segment(s), {contiguous} bytes from minaddr to maxaddr\n'
+        for name, block_size, trim in (('block', BLOCK_SIZE, False), ('extended', PAYLOAD_SIZE, True)):
+            sent = sum(len(data) for address, data in STM32Flasher.loadBlocks(filename, block_size, trim))
+            yield f'{name:>16} : {sent:8} bytes sent, {contiguous - sent:8} bytes saved ({100 * (contiguous - sent) / contiguous:.1f}%)\n'
+        sent = sum(len(data) for address, data in STM32Flasher.loadSegments(filename))
+        yield f'{"write":>16} : {sent:8} bytes sent, {contiguous - sent:8} bytes saved ({100 * (contiguous - sent) / contiguous:.1f}%)\n'
+
+    def writeImage(self, filename, auto_erase=True):
+        # Sends an CMD_WRITE to the bootloader
+        # This is method is a generator, that returns its progresses to the caller.
+        # In this way, it's possible for the caller to live-print messages about
+        # writing progress
+        # With auto_erase, the bootloader erases the sectors of the image as they are reached.
+        blocks = self.loadBlocks(filename)
+        if not self._startSession(imageEnd(filename) if auto_erase else None):
+            yield 'Unable to unlock the flash!'
+            return
+
         with Bar('Loading', fill='#', suffix='%(percent).1f%% - %(elapsed).1fs',
-                 max=int(len(file_content) / 16)) as bar:
-            while current_address <= MAX_ADDRESS:
-
-                data = []
-                block_address = current_address
-                # read block (16 bytes) from the file into data
-                for i in range(16):
-                    try:
-                        data.append(file_content[current_address])
-                    except KeyError:
-                        # if we exceed the max addr and the HEX file doesn't contain a value for the given address
-                        # we "pad" it with 0xFF, which corresponds to erased value
-                        data.append(0xFF)
-                    current_address += 1
-                #   block was loaded from hex file
+                 max=len(blocks)) as bar:
+            for block_address, data in blocks:
                 try:
                     # Flush input buffer, discarding all its contents.
                     self.serial.flushInput()
@@ -100,7 +396,7 @@ class STM32Flasher(object):
                     #  check for acknowledgement by read the received byte
                     ret = self.serial.read(1)
 
-                    if ret == ACK:
+                    if ret == bytes([ACK]):
                         bar.next()
                     else:
                         # raise an error if not receiving an ack
@@ -116,12 +412,919 @@ class STM32Flasher(object):
         bar.finish()
         yield 'Image has been written successfully!'
 
+    def writeImageWindowed(self, filename, window=WINDOW_SIZE, auto_erase=True):
+        # Same as writeImage, but keeps up to `window` sequence numbered frames in flight
+        # instead of waiting for an ACK after every block.
+        # The bootloader acknowledges cumulatively with [ACK][SEQ of the last programmed frame],
+        # an ACK that doesn't move the window forward means a frame was lost, so the
+        # transfer goes back to the oldest frame not acknowledged (go-back-N).
+        def frame(seq, address, data):
+            return [COMMANDS['FLASH_PROGRAM_WIN'], seq] + list(struct.pack("I", address)) + list(data)
+
+        yield from self._writeWindowed(self.loadBlocks(filename), frame, window,
+                                       imageEnd(filename) if auto_erase else None)
+
+    def writeImageExtended(self, filename, payload=PAYLOAD_SIZE, window=EXT_WINDOW_SIZE, auto_erase=True):
+        # Same as writeImageWindowed, but every frame carries up to `payload` bytes
+        # with an explicit 16-bit length : [CMD][SEQ][ADDRESS][LENGTH][payload].
+        blocks = self.loadBlocks(filename, payload, trim=True)
+
+        def frame(seq, address, data):
+            return [COMMANDS['FLASH_PROGRAM_EXT'], seq] + list(struct.pack("<IH", address, len(data))) + list(data)
+
+        yield from self._writeWindowed(blocks, frame, window, imageEnd(filename) if auto_erase else None)
+
+    def writeImageResumable(self, filename, payload=PAYLOAD_SIZE, window=EXT_WINDOW_SIZE, attempts=RESUME_ATTEMPTS):
+        # Same as writeImageExtended, but the bootloader journals the frames programmed in
+        # order from the start of the image : after a disconnect or a power loss the transfer
+        # starts again from the first byte missing, in this run or a later one. The image is
+        # sent contiguous (the gaps as 0xFF, skipped by the bootloader) so the journal has no hole.
+        start, image = loadImage(filename)
+        crc = crc32Stm(image)
+
+        def frame(seq, address, data):
+            return [COMMANDS['FLASH_PROGRAM_EXT'], seq] + list(struct.pack("<IH", address, len(data))) + list(data)
+
+        for attempt in range(attempts):
+            try:
+                if attempt:
+                    yield f'\nReconnecting ({attempt}/{attempts - 1})...\n'
+                    self.serial.close()
+                    self.serial.open()
+                    self.wake(RESUME_WAKE)
+
+                if not self._startSession(start + len(image)):
+                    yield 'Unable to unlock the flash!\n'
+                    continue
+                committed = self.journalBegin(start, len(image), crc)
+                if committed is None:
+                    yield 'Unable to open the journal!\n'
+                    continue
+                if committed:
+                    yield f'Resuming at {hex(start + committed)}, {committed} bytes already written\n'
+
+                blocks = [(start + offset, image[offset:offset + payload])
+                          for offset in range(committed, len(image), payload)]
+                timeout = self.serial.timeout
+                self.serial.timeout = ERASE_TIMEOUT
+                try:
+                    with Bar('Loading', fill='#', suffix='%(percent).1f%% - %(elapsed).1fs',
+                             max=len(blocks)) as bar:
+                        done = yield from self._sendWindowed(blocks, frame, window, bar, silence=RESUME_SILENCE)
+                finally:
+                    self.serial.timeout = timeout
+            except serial.SerialException as error:
+                yield f'\nConnection lost : {error}\n'
+                time.sleep(RESUME_WAKE)
+                continue
+
+            if done is False:
+                return
+            if done:
+                # the resumed parts come from other sessions, the whole image is checked.
+                remote = self.crcCheck(start, len(image))
+                if remote == crc:
+                    yield f'Verified : CRC {remote:08X} over {len(image)} bytes\n'
+                    yield 'Image has been written successfully!'
+                    return
+                if remote is None:
+                    yield '\nUnable to read the image CRC!\n'
+                else:
+                    yield f'\nVerify failed : device CRC {remote:08X}, image CRC {crc:08X}\n'
+                    # the next run starts from the beginning.
+                    self.journalClear()
+                break
+        yield 'Operation Failed!'
+
+    def journalBegin(self, address, size, crc):
+        # Journal the program frames of the image, returns the bytes already programmed
+        # by an earlier session of the same image (0 for a new one), None if refused.
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['JOURNAL'], JOURNAL_BEGIN] + list(struct.pack('<3I', address, size, crc)))
+        ret = self.serial.read(5)
+        if len(ret) < 5 or ret[0] != ACK:
+            return None
+        return struct.unpack('<I', ret[1:5])[0]
+
+    def journalQuery(self):
+        # (address, size, crc, committed) of the journaled image, size 0 without journal, None if no reply.
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['JOURNAL'], JOURNAL_QUERY] + [0] * 12)
+        ret = self.serial.read(17)
+        if len(ret) < 17 or ret[0] != ACK:
+            return None
+        return struct.unpack('<4I', ret[1:17])
+
+    def journalReport(self):
+        journal = self.journalQuery()
+        if journal is None:
+            yield 'Unable to read the journal!\n'
+            return
+        address, size, crc, committed = journal
+        if not size:
+            yield 'No update journal\n'
+            return
+        yield (f'Image of {size} bytes at {hex(address)}, CRC {crc:08X} : '
+               f'{committed} bytes written ({100 * committed / size:.1f}%)\n')
+
+    def journalClear(self):
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['JOURNAL'], JOURNAL_CLEAR] + [0] * 12)
+        return self.serial.read(1) == bytes([ACK])
+
+    def ramArea(self):
+        # (start, end) of the SRAM the RAM images are loaded to, None if no reply.
+        # Also restarts the sequence numbers of the RAM writes.
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['RAM_EXEC'], RAM_AREA] + [0] * 4)
+        ret = self.serial.read(9)
+        if len(ret) < 9 or ret[0] != ACK:
+            return None
+        return struct.unpack('<2I', ret[1:9])
+
+    def ramRelease(self):
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['RAM_EXEC'], RAM_RELEASE] + [0] * 4)
+        return self.serial.read(1) == bytes([ACK])
+
+    def runImageRam(self, filename, window=EXT_WINDOW_SIZE):
+        # Load the image into the RAM area with extended frames and run it, the flash is
+        # neither erased nor programmed. The image must be linked inside the area with its
+        # vector table first, aligned on 512 bytes (VTOR).
+        start, image = loadImage(filename)
+        area = self.ramArea()
+        if area is None:
+            yield 'Unable to read the RAM area!\n'
+            return
+        if start < area[0] or start + len(image) > area[1]:
+            yield f'The image must be linked inside the RAM area {hex(area[0])} - {hex(area[1])}\n'
+            return
+
+        blocks = [(start + offset, image[offset:offset + PAYLOAD_SIZE])
+                  for offset in range(0, len(image), PAYLOAD_SIZE)]
+
+        def frame(seq, address, data):
+            return [COMMANDS['RAM_WRITE'], seq] + list(struct.pack("<IH", address, len(data))) + list(data)
+
+        timeout = self.serial.timeout
+        self.serial.timeout = WINDOW_TIMEOUT
+        try:
+            with Bar('Loading', fill='#', suffix='%(percent).1f%% - %(elapsed).1fs',
+                     max=len(blocks)) as bar:
+                if not (yield from self._sendWindowed(blocks, frame, window, bar)):
+                    return
+        finally:
+            self.serial.timeout = timeout
+        bar.finish()
+
+        self.serial.write([COMMANDS['RAM_EXEC'], RAM_RUN] + list(struct.pack('<I', start)))
+        if self.serial.read(1) == bytes([ACK]):
+            yield f'RAM image running at {hex(start)}\n'
+        else:
+            yield 'Unable to run the RAM image!\n'
+            errors = self.serial.read(toInt(self.serial.read(1)))
+            for err in errors:
+                yield ERRORS[err] + '\n'
+
+    def runApplet(self, applet, param=0, dst=(0, 0), data=None, window=EXT_WINDOW_SIZE):
+        # Load a flash applet (raw binary built in Applets/) at the start of the RAM area with
+        # the data file after it, then call it in a program session (auto erase up to the end
+        # of DST) : SRC is the data (empty without), DST the given (address, size).
+        with open(applet, 'rb') as applet_file:
+            code = applet_file.read()
+        src = b''
+        if data:
+            with open(data, 'rb') as data_file:
+                src = data_file.read()
+        code += b'\xFF' * (-len(code) % 4)
+        load = code + src + b'\xFF' * (-len(src) % 4)
+
+        area = self.ramArea()
+        if area is None:
+            yield 'Unable to read the RAM area!\n'
+            return
+        if area[0] + len(load) > area[1]:
+            yield f'The applet and its data ({len(load)} bytes) don\'t fit the RAM area {hex(area[0])} - {hex(area[1])}\n'
+            return
+
+        blocks = [(area[0] + offset, load[offset:offset + PAYLOAD_SIZE])
+                  for offset in range(0, len(load), PAYLOAD_SIZE)]
+
+        def frame(seq, address, data):
+            return [COMMANDS['RAM_WRITE'], seq] + list(struct.pack("<IH", address, len(data))) + list(data)
+
+        timeout = self.serial.timeout
+        self.serial.timeout = WINDOW_TIMEOUT
+        try:
+            with Bar('Loading', fill='#', suffix='%(percent).1f%% - %(elapsed).1fs',
+                     max=len(blocks)) as bar:
+                if not (yield from self._sendWindowed(blocks, frame, window, bar)):
+                    return
+        finally:
+            self.serial.timeout = timeout
+        bar.finish()
+
+        if not self._startSession(dst[0] + dst[1]):
+            yield 'Unable to unlock the flash!\n'
+            return
+
+        self.serial.timeout = APPLET_TIMEOUT
+        try:
+            self.serial.write([COMMANDS['APPLET']] + list(struct.pack('<6I', area[0], param, area[0] + len(code),
+                                                                      len(src), dst[0], dst[1])))
+            ret = self.serial.read(1)
+            if ret == bytes([ACK]):
+                status, result, duration = struct.unpack('<3I', self.serial.read(12))
+                yield (f'Applet {APPLET_STATUS.get(status, hex(status))}, result {result} ({hex(result)}), '
+                       f'ran {duration} us\n')
+            else:
+                yield 'Unable to call the applet!\n'
+                errors = self.serial.read(toInt(self.serial.read(1)))
+                for err in errors:
+                    yield ERRORS[err] + '\n'
+        finally:
+            self.serial.timeout = timeout
+
+        if not self.ramRelease():
+            yield 'Unable to release the RAM area!\n'
+        for msg in self.lockFlash():
+            yield msg + '\n'
+
+    def writeImageCoalesced(self, filename, window=EXT_WINDOW_SIZE, auto_erase=True):
+        # Same as writeImageExtended, but the segments of the hex file are sent as they are
+        # (any address and length) : [CMD][SEQ][ADDRESS][LENGTH][payload]. The bootloader
+        # merges the adjacent writes into words, a last frame without payload flushes them.
+        blocks = self.loadSegments(filename)
+        blocks.append((0, b''))
+
+        def frame(seq, address, data):
+            return [COMMANDS['FLASH_WRITE'], seq] + list(struct.pack("<IH", address, len(data))) + list(data)
+
+        for msg in self._writeWindowed(blocks, frame, window, imageEnd(filename) if auto_erase else None):
+            yield msg
+        stats = self.writeStats()
+        if stats and msg == 'Image has been written successfully!':
+            yield (f'\n{stats["bytes"]} bytes in {stats["writes"]} writes : {stats["words"]} words and '
+                   f'{stats["fragments"]} fragments programmed\n')
+
+    def writeImageCompressed(self, filename, window=EXT_WINDOW_SIZE, auto_erase=True):
+        # Same as writeImageExtended, but every RAW_SIZE bytes of the image are sent as
+        # one LZ4 block : [CMD][SEQ][ADDRESS][LENGTH][RAW LENGTH][block], decoded by the
+        # bootloader in RAM before programming. Chunks that don't compress below
+        # PAYLOAD_SIZE go as plain extended frames.
+        blocks = self.loadBlocks(filename, RAW_SIZE, trim=True)
+
+        frames = []
+        for address, data in blocks:
+            packed = lz4Compress(data)
+            if len(packed) <= PAYLOAD_SIZE:
+                frames.append((address, (packed, len(data))))
+            else:
+                for offset in range(0, len(data), PAYLOAD_SIZE):
+                    frames.append((address + offset, (bytes(data[offset:offset + PAYLOAD_SIZE]), None)))
+        self.wireBytes = sum(len(payload) for address, (payload, raw) in frames)
+
+        def frame(seq, address, data):
+            payload, raw = data
+            if raw is None:
+                return [COMMANDS['FLASH_PROGRAM_EXT'], seq] + list(struct.pack("<IH", address, len(payload))) + list(payload)
+            return [COMMANDS['FLASH_PROGRAM_LZ4'], seq] + list(struct.pack("<IHH", address, len(payload), raw)) + list(payload)
+
+        yield from self._writeWindowed(frames, frame, window, imageEnd(filename) if auto_erase else None)
+
+    def writeImageDelta(self, filename, old_filename, dest, window=EXT_WINDOW_SIZE):
+        # Write the image of `filename` at `dest` from the image of `old_filename`, which
+        # must be the one installed on the device: unchanged runs are copied on the device
+        # (BOOT_CPY_IMAGE), only the changed bytes are sent.
+        # The destination sectors are erased by the bootloader, so they must not hold any
+        # part of the installed image.
+        old_address, old = loadImage(old_filename)
+        new_address, new = loadImage(filename)
+        if sectorsOf(dest, len(new)) & sectorsOf(old_address, len(old)):
+            yield 'The destination shares a sector with the installed image!'
+            return
+
+        # pack the operations into frames, [CMD][SEQ][ADDRESS][LENGTH][operations].
+        frames = []
+        payload = bytearray()
+        address = cursor = dest
+        copied = 0
+        for op in makeDelta(old, old_address, new):
+            if op[0] == DELTA_COPY:
+                pieces = [struct.pack('<BII', DELTA_COPY, op[1], op[2])]
+                sizes = [op[2]]
+                copied += op[2]
+            else:
+                step = (PAYLOAD_SIZE - 3) & ~3
+                pieces = [struct.pack('<BH', DELTA_INSERT, len(op[1][k:k + step])) + op[1][k:k + step]
+                          for k in range(0, len(op[1]), step)]
+                sizes = [len(op[1][k:k + step]) for k in range(0, len(op[1]), step)]
+            for piece, size in zip(pieces, sizes):
+                if payload and (len(payload) + len(piece) > PAYLOAD_SIZE or cursor + size - address > DELTA_MAX_SPAN):
+                    frames.append((address, bytes(payload)))
+                    payload = bytearray()
+                    address = cursor
+                payload += piece
+                cursor += size
+        if payload:
+            frames.append((address, bytes(payload)))
+        self.wireBytes = sum(len(payload) for address, payload in frames)
+
+        def frame(seq, address, data):
+            return [COMMANDS['FLASH_DELTA'], seq] + list(struct.pack("<IH", address, len(data))) + list(data)
+
+        yield f'Delta : {copied} of {len(new)} bytes copied on the device, {self.wireBytes} bytes to send\n'
+        yield from self._writeWindowed(frames, frame, window, dest + len(new))
+
+    def copyImage(self, src, dest, size):
+        # Copy [src, src + size) to dest on the device. The bootloader erases the destination
+        # sectors that need it (data of those sectors outside of the copy is lost), skips the
+        # words already identical and reports its progress, then the CRC of the copy.
+        for msg in self.unlockFlash():
+            pass
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['FLASH_COPY']] + list(struct.pack('<III', src, dest, size)))
+
+        done = 0
+        with Bar('Copying', fill='#', suffix='%(percent).1f%% - %(elapsed).1fs', max=size) as bar:
+            while True:
+                ret = self.serial.read(1)
+                if ret == bytes([PROGRESS]):
+                    copied = struct.unpack('<I', self.serial.read(4))[0]
+                    bar.next(copied - done)
+                    done = copied
+                    continue
+                if ret == bytes([ACK]):
+                    crc = struct.unpack('<I', self.serial.read(4))[0]
+                    break
+                yield f'\nThe following error(s) occurred while copying to address :  {hex(dest + done)}\n'
+                if ret == bytes([NACK]):
+                    for err in self.serial.read(toInt(self.serial.read(1))):
+                        yield ERRORS[err] + '\n'
+                yield 'Operation Failed!'
+                return
+        bar.finish()
+
+        remote = self.crcCheck(src, size)
+        if remote is None:
+            yield '\nUnable to read the source CRC!\n'
+            return
+        if remote != crc:
+            yield f'\nCopy mismatch : source CRC {remote:08X}, destination CRC {crc:08X}\n'
+            return
+        yield f'\nImage has been copied successfully! CRC {crc:08X}'
+
+    def crcCheck(self, address, size):
+        # CRC of [address, address + size) computed by the CRC unit of the device, None if refused.
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['CRC_CHECK']] + list(struct.pack('<II', address, size)))
+        ret = self.serial.read(5)
+        if len(ret) < 5 or ret[0] != ACK:
+            return None
+        return struct.unpack('<I', ret[1:5])[0]
+
+    def verifyImage(self, filename):
+        # Compare the CRC of the whole image on the device with the one of the hex file,
+        # the gaps of the image are expected erased.
+        start, image = loadImage(filename)
+        remote = self.crcCheck(start, len(image))
+        if remote is None:
+            yield '\nUnable to read the image CRC!\n'
+        elif remote != crc32Stm(image):
+            yield f'\nVerify failed : device CRC {remote:08X}, image CRC {crc32Stm(image):08X}\n'
+        else:
+            yield f'\nVerified : CRC {remote:08X} over {len(image)} bytes\n'
+
+    def blankCheck(self, address, size):
+        # Address of the first word not erased in [address, address + size) on the device,
+        # address + size when the area is blank, None if refused.
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['BLANK_CHECK']] + list(struct.pack('<II', address, size)))
+        ret = self.serial.read(5)
+        if len(ret) < 5 or ret[0] != ACK:
+            return None
+        return struct.unpack('<I', ret[1:5])[0]
+
+    def blankReport(self):
+        # Blank state of every sector.
+        for n, (base, size) in enumerate(SECTORS):
+            first = self.blankCheck(base, size)
+            if first is None:
+                yield f'sector {n} : blank check refused\n'
+            elif first == base + size:
+                yield f'sector {n} : blank\n'
+            else:
+                yield f'sector {n} : programmed from {hex(first)}\n'
+
+    def wear(self):
+        # (count, sequence, last ms, first ms) of every sector, None if refused.
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['WEAR']])
+        ret = self.serial.read(2)
+        if len(ret) < 2 or ret[0] != ACK:
+            return None
+        data = self.serial.read(12 * ret[1])
+        if len(data) < 12 * ret[1]:
+            return None
+        return [struct.unpack('<IIHH', data[12 * n:12 * n + 12]) for n in range(ret[1])]
+
+    def wearReport(self):
+        # Erase count of every sector against its endurance, and the growth of its erase time.
+        records = self.wear()
+        if records is None:
+            yield 'Unable to read the wear records!\n'
+            return
+        for n, (count, sequence, last, first) in enumerate(records):
+            if not count:
+                yield f'sector {n} : no erase recorded\n'
+                continue
+            ratio = last / first if first else 1.0
+            yield (f'sector {n} : {count} erases ({100 * count / SECTOR_ENDURANCE:.2f} % of {SECTOR_ENDURANCE}), '
+                   f'last #{sequence} in {last} ms, first in {first} ms (x{ratio:.2f})'
+                   + (' WORN\n' if count >= SECTOR_ENDURANCE or ratio >= WEAR_TIME_RATIO else '\n'))
+
+    def blockCrcs(self, address, size, block=CRC_BLOCK_SIZE):
+        # CRC of every `block` bytes of [address, address + size) read on the device, None if refused.
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['BLOCK_CRC']] + list(struct.pack('<IIH', address, size, block)))
+        ret = self.serial.read(3)
+        if len(ret) < 3 or ret[0] != ACK:
+            return None
+        count = struct.unpack('<H', ret[1:3])[0]
+        data = self.serial.read(4 * count)
+        if len(data) < 4 * count:
+            return None
+        return list(struct.unpack(f'<{count}I', data))
+
+    def writeImageIncremental(self, filename, block=CRC_BLOCK_SIZE, window=EXT_WINDOW_SIZE):
+        # Compare the block CRCs of the device with the image and only send the blocks that
+        # differ. A block blank on the device is programmed as is, otherwise its sector is
+        # erased and every non blank block of the image inside that sector is sent again
+        # (data of the sector outside of the image is lost).
+        start, image = loadImage(filename)
+        offset = start % block
+        start -= offset
+        image = b'\xFF' * offset + image
+        image += b'\xFF' * (-len(image) % block)
+
+        remote = self.blockCrcs(start, len(image), block)
+        if remote is None:
+            yield 'Unable to read the block CRCs!'
+            return
+
+        blank = crc32Stm(b'\xFF' * block)
+        blocks = [(start + k, image[k:k + block]) for k in range(0, len(image), block)]
+        changed = [n for n, (address, data) in enumerate(blocks) if crc32Stm(data) != remote[n]]
+
+        # sectors to erase : a changed block is not blank on the device.
+        sectors = sorted({n for n, (base, size) in enumerate(SECTORS)
+                          for k in changed if remote[k] != blank and base <= blocks[k][0] < base + size})
+        send = [k for k, (address, data) in enumerate(blocks)
+                if data != b'\xFF' * block and
+                (k in changed or any(SECTORS[n][0] <= address < SECTORS[n][0] + SECTORS[n][1] for n in sectors))]
+
+        yield f'{len(changed)} of {len(blocks)} blocks changed, {len(sectors)} sector(s) to erase\n'
+        if not changed:
+            yield 'Image is already up to date!'
+            return
+
+        for msg in self.unlockFlash():
+            pass
+        for n in sectors:
+            for msg in self.eraseFlash(n, 1):
+                if msg != 'Flash has been erased successfully!':
+                    yield msg
+                    return
+
+        def frame(seq, address, data):
+            return [COMMANDS['FLASH_PROGRAM_EXT'], seq] + list(struct.pack("<IH", address, len(data))) + list(data)
+
+        yield from self._writeWindowed([blocks[k] for k in send], frame, window)
+
+    def _startSession(self, erase_limit=None):
+        # Unlocking the flash opens a new program session, sequence numbers restart at 0.
+        # With an erase_limit, the auto erase is turned on : the bootloader erases every
+        # sector on its first write and erases ahead the sectors below erase_limit.
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['FLACH_UNLOCK']])
+        if self.serial.read(1) != bytes([ACK]):
+            return False
+        if erase_limit is None:
+            return True
+        self.serial.write([COMMANDS['AUTO_ERASE'], 1] + list(struct.pack('<I', erase_limit)))
+        return self.serial.read(1) == bytes([ACK])
+
+    def _writeWindowed(self, blocks, frame, window, erase_limit=None):
+        if not self._startSession(erase_limit):
+            yield 'Unable to unlock the flash!'
+            return
+
+        timeout = self.serial.timeout
+        self.serial.timeout = WINDOW_TIMEOUT if erase_limit is None else ERASE_TIMEOUT
+        try:
+            with Bar('Loading', fill='#', suffix='%(percent).1f%% - %(elapsed).1fs',
+                     max=len(blocks)) as bar:
+                if not (yield from self._sendWindowed(blocks, frame, window, bar)):
+                    return
+        finally:
+            self.serial.timeout = timeout
+        bar.finish()
+        yield 'Image has been written successfully!'
+
+    def _sendWindowed(self, blocks, frame, window, bar, first_seq=0, silence=None):
+        # Send the frames of `blocks` with go-back-N, the first one with sequence number
+        # `first_seq`. Yields the error messages, returns True once every frame is acknowledged,
+        # False on a program error, None after `silence` reads in a row without a reply.
+        base = 0  # oldest frame not acknowledged yet
+        next_frame = 0  # next frame to send
+        silent = 0  # reads without a reply in a row
+        while base < len(blocks):
+            # fill the window.
+            while next_frame < len(blocks) and next_frame - base < window:
+                block_address, data = blocks[next_frame]
+                self.serial.write(frame((first_seq + next_frame) & 0xFF, block_address, data))
+                next_frame += 1
+
+            ret = self.serial.read(2)
+            if len(ret) < 2 or ret[0] not in (ACK, NACK):
+                # nothing (or garbage) came back, resend everything in flight.
+                self.serial.flushInput()
+                next_frame = base
+                silent = silent + 1 if not ret else 0
+                if silence is not None and silent >= silence:
+                    yield '\nNo reply from the device!\n'
+                    return None
+                continue
+            silent = 0
+
+            if ret[0] == NACK:
+                failed = base + ((ret[1] - first_seq - base) & 0xFF)
+                yield f'\nThe following error(s) occurred while writing at address :  {hex(blocks[failed][0])}\n'
+                num_errs = self.serial.read(1)
+                errors = self.serial.read(toInt(num_errs))
+                for err in errors:
+                    yield ERRORS[err] + '\n'
+                yield 'Operation Failed!'
+                return False
+
+            acked = (ret[1] + 1 - first_seq - base) & 0xFF
+            if 0 < acked <= next_frame - base:
+                base += acked
+                bar.next(acked)
+            else:
+                # duplicate ACK, a frame has been lost.
+                next_frame = base
+        return True
+
+    def _staging(self, op, address=0, size=0):
+        # Send a staging operation, returns the error codes of a NACK (empty on success).
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['STAGING'], op] + list(struct.pack('<II', address, size)))
+        ret = self.serial.read(1)
+        if ret == bytes([ACK]):
+            return b''
+        if ret != bytes([NACK]):
+            return bytes([0xE6])
+        return self.serial.read(toInt(self.serial.read(1)))
+
+    def writeImageStaged(self, filename, window=EXT_WINDOW_SIZE):
+        # Program the image STAGING_SIZE bytes at a time : the extended frames of a window
+        # are collected in the RAM of the bootloader, then STAGING_COMMIT erases the sectors
+        # reached for the first time and programs the window in one burst. A window only
+        # touches the flash once it has been completely received.
+        blocks = self.loadBlocks(filename, PAYLOAD_SIZE, trim=True)
+        windows = {}
+        for address, data in blocks:
+            windows.setdefault(address - address % STAGING_SIZE, []).append((address, data))
+
+        def frame(seq, address, data):
+            return [COMMANDS['FLASH_PROGRAM_EXT'], seq] + list(struct.pack("<IH", address, len(data))) + list(data)
+
+        if not self._startSession():
+            yield 'Unable to unlock the flash!'
+            return
+
+        seq = 0
+        timeout = self.serial.timeout
+        try:
+            with Bar('Loading', fill='#', suffix='%(percent).1f%% - %(elapsed).1fs',
+                     max=len(blocks)) as bar:
+                for base in sorted(windows):
+                    self.serial.timeout = timeout
+                    errors = self._staging(STAGING_OPEN, base, STAGING_SIZE)
+                    if not errors:
+                        self.serial.timeout = WINDOW_TIMEOUT
+                        if not (yield from self._sendWindowed(windows[base], frame, window, bar, seq)):
+                            self._staging(STAGING_ABORT)
+                            return
+                        seq += len(windows[base])
+                        # the commit erases up to a 128 KB sector.
+                        self.serial.timeout = ERASE_TIMEOUT
+                        errors = self._staging(STAGING_COMMIT)
+                    if errors:
+                        yield f'\nThe following error(s) occurred while writing the window at address :  {hex(base)}\n'
+                        for err in errors:
+                            yield ERRORS[err] + '\n'
+                        yield 'Operation Failed!'
+                        return
+        finally:
+            self.serial.timeout = timeout
+        bar.finish()
+        yield 'Image has been written successfully!'
+
+    def eraseFlash(self, sector, nb_sectors):
+        # The bootloader acknowledges the start of the erase and erases in the background,
+        # the completion is polled with ERASE_STATUS.
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['FLASH_ERASE'], sector, nb_sectors])
+        #  check for acknowledgement by read the received byte
+        ret = self.serial.read(1)
+        if ret != bytes([ACK]):
+            # [NACK][ERRORS COUNT][ERRORS][first sector]
+            errors = self.serial.read(toInt(self.serial.read(1)))
+            yield f'The erase has been refused at sector {toInt(self.serial.read(1))}\n'
+            for err in errors:
+                yield ERRORS[err] + '\n'
+            return
+
+        status = self.waitErase()
+        if status is None:
+            yield 'No erase status from the device!'
+            return
+        state, sector, remaining, elapsed, errors = status
+        if state == ERASE_DONE:
+            yield 'Flash has been erased successfully!'
+            return
+        yield f'The following error(s) occurred while erasing the flash\n'
+        for err in errors:
+            yield ERRORS[err] + '\n'
+        yield f' > Failed at sector {sector}\n'
+
+    def eraseStatus(self):
+        # (state, sector, sectors left, elapsed ms, errors) of the last erase, None if no reply.
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['ERASE_STATUS']])
+        ret = self.serial.read(8)
+        if len(ret) < 8 or ret[0] != ACK:
+            return None
+        state, sector, remaining, elapsed = struct.unpack('<BBBI', ret[1:8])
+        errors = b''
+        if state == ERASE_FAILED:
+            errors = self.serial.read(toInt(self.serial.read(1)))
+        return state, sector, remaining, elapsed, errors
+
+    def waitErase(self):
+        # Poll the erase status until the erase is over, None if the device stops replying.
+        while True:
+            status = self.eraseStatus()
+            if status is None or status[0] != ERASE_BUSY:
+                return status
+            time.sleep(ERASE_POLL)
+
+    def benchmark(self, filename, sector, nb_sectors):
+        # Program the same image with every program mode and compare the throughput.
+        # The target sectors are erased before each run, the auto erase is left off.
+        nbytes = len(self.loadBlocks(filename)) * BLOCK_SIZE
+        modes = (('stop-and-wait', self.writeImage),
+                 ('windowed', self.writeImageWindowed),
+                 ('extended', self.writeImageExtended),
+                 ('compressed', self.writeImageCompressed))
+        results = []
+        stats = None
+        for name, writer in modes:
+            for msg in self.unlockFlash():
+                pass
+            for msg in self.eraseFlash(sector, nb_sectors):
+                pass
+            start = time.perf_counter()
+            for msg in writer(filename, auto_erase=False):
+                pass
+            elapsed = time.perf_counter() - start
+            if msg != 'Image has been written successfully!':
+                yield f'{name}: {msg}\n'
+                return
+            results.append((name, elapsed))
+
+            if writer == self.writeImageExtended:
+                stats = self.stageStats()
+
+        yield f'\n{nbytes} bytes image\n'
+        for name, elapsed in results:
+            yield f'{name:>16} : {elapsed:7.2f} s  {nbytes / elapsed:9.0f} bytes/s  x{results[0][1] / elapsed:.2f}\n'
+        yield f'\ncompressed payload : {self.wireBytes} bytes ({100 * self.wireBytes / nbytes:.1f}% of the image)\n'
+        if stats and stats['frames'] > 1:
+            frames = stats['frames']
+            yield (f'\nextended frames : {frames} frames, period {stats["period_us"] / (frames - 1):.0f} us, '
+                   f'program {stats["program_us"] / frames:.0f} us, '
+                   f'{100 * stats["hidden"]:.1f}% of the program time overlapped with the reception\n')
+
+    def engineBenchmark(self, sector, size=2 * RAW_SIZE):
+        # Erase `sector` and let the bootloader program `size` bytes at its start, half
+        # through HAL_FLASH_Program and half through its RAM engine, then compare the cycles.
+        for msg in self.unlockFlash():
+            pass
+        for msg in self.eraseFlash(sector, 1):
+            if msg != 'Flash has been erased successfully!':
+                yield msg
+                return
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['FLASH_BENCH']] + list(struct.pack('<II', SECTORS[sector][0], size)))
+        ret = self.serial.read(13)
+        if len(ret) < 13 or ret[0] != ACK:
+            yield 'Benchmark failed!'
+            return
+        words, hal, engine = struct.unpack('<III', ret[1:13])
+        yield f'{words} words per path (84 MHz core)\n'
+        yield f'{"HAL_FLASH_Program":>18} : {hal:9} cycles  {hal / words:7.1f} cycles/word\n'
+        yield f'{"RAM engine":>18} : {engine:9} cycles  {engine / words:7.1f} cycles/word  x{hal / engine:.2f}\n'
+
+    def setBaudrate(self, baudrate):
+        # Move the link to `baudrate`: the request is acknowledged at the current rate,
+        # then repeated at the new one and acknowledged there. The bootloader keeps the
+        # new rate once a further frame (erase status) arrives at it, otherwise both
+        # sides go back to the current rate.
+        request = bytes([COMMANDS['SET_BAUD']]) + struct.pack("<I", baudrate) + BAUD_PATTERN
+        previous = self.serial.baudrate
+
+        self.serial.flushInput()
+        self.serial.write(request)
+        ret = self.serial.read(1)
+        if ret != bytes([ACK]):
+            # rate refused (not reachable from PCLK2) : [NACK][1][BAUD_ERR_MSG].
+            self.serial.read(2)
+            self.serial.flushInput()
+            return False
+        self.serial.flush()
+
+        timeout = self.serial.timeout
+        self.serial.timeout = BAUD_VERIFY_TIME / 2
+        try:
+            self.serial.baudrate = baudrate
+            time.sleep(0.01)
+            self.serial.flushInput()
+            self.serial.write(request)
+            if self.serial.read(1) == bytes([ACK]) and self.eraseStatus() is not None:
+                return True
+            # the bootloader falls back on its own when no frame follows at the new rate.
+            self.serial.baudrate = previous
+            time.sleep(BAUD_KEEP_TIME)
+            self.serial.flushInput()
+            if self.eraseStatus() is not None:
+                return False
+            # only the reply was lost, the bootloader kept the new rate.
+            self.serial.baudrate = baudrate
+            time.sleep(0.01)
+            return self.eraseStatus() is not None
+        finally:
+            self.serial.timeout = timeout
+
+    def probeBaudrate(self, rates=BAUD_RATES):
+        # Switch to the fastest rate of `rates` the link sustains, returns the rate in use.
+        for baudrate in sorted(rates, reverse=True):
+            if baudrate <= self.serial.baudrate:
+                break
+            if self.setBaudrate(baudrate):
+                break
+        return self.serial.baudrate
+
+    def readStats(self, selector):
+        # Returns the raw statistics block of `selector`, None if refused.
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['STATS'], selector])
+        ret = self.serial.read(2)
+        if len(ret) < 2 or ret[0] != ACK:
+            return None
+        return self.serial.read(ret[1])
+
+    def stageStats(self):
+        # Overlap of the flash programming with the reception for the extended frames
+        # programmed since the last unlock.
+        data = self.readStats(STATS_PROG_STAGE)
+        if data is None or len(data) < 20:
+            return None
+        frames, nbytes, period, program, wait = struct.unpack('<5I', data[:20])
+        return {'frames': frames, 'bytes': nbytes, 'period_us': period,
+                'program_us': program, 'wait_us': wait,
+                'hidden': (program - wait) / program if program else 0.0}
+
+    def writeStats(self):
+        # Write coalescing of the session : writes and bytes received, word and fragment programs.
+        data = self.readStats(STATS_WRITE)
+        if data is None or len(data) < 16:
+            return None
+        writes, nbytes, words, fragments = struct.unpack('<4I', data[:16])
+        return {'writes': writes, 'bytes': nbytes, 'words': words, 'fragments': fragments}
+
+    def imageInfo(self, address=APP_ADDRESS):
+        # (state, (magic, version, load address, length, entry, crc)) of the header at address,
+        # None if no reply. The device doesn't compute any CRC for it.
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['IMAGE_INFO']] + list(struct.pack('<I', address)))
+        ret = self.serial.read(26)
+        if len(ret) < 26 or ret[0] != ACK:
+            return None
+        return ret[1], struct.unpack('<6I', ret[2:26])
+
+    def imageReport(self, address=APP_ADDRESS):
+        info = self.imageInfo(address)
+        if info is None:
+            yield 'Unable to read the image header!\n'
+            return
+        state, (magic, version, load, length, entry, crc) = info
+        yield f'Image at {hex(address)} : {IMAGE_STATES.get(state, hex(state))}\n'
+        if state:
+            yield f' > version {version}, {length} bytes at {hex(load)}, entry {hex(entry)}, CRC {crc:08X}\n'
+
+    def slotInfo(self):
+        # (image state, slot state, tries, sequence, crc) of every slot, None if no reply.
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['SLOT'], SLOT_INFO, 0])
+        ret = self.serial.read(2)
+        if len(ret) < 2 or ret[0] != ACK:
+            return None
+        data = self.serial.read(11 * ret[1])
+        if len(data) < 11 * ret[1]:
+            return None
+        return [struct.unpack('<BBBII', data[11 * n:11 * n + 11]) for n in range(ret[1])]
+
+    def slotReport(self):
+        slots = self.slotInfo()
+        if slots is None:
+            yield 'Unable to read the slots!\n'
+            return
+        for name, (image, state, tries, sequence, crc) in zip(SLOTS, slots):
+            yield (f'slot {name} : image {IMAGE_STATES.get(image, hex(image))}, '
+                   f'{SLOT_STATES.get(state, hex(state))} #{sequence}')
+            yield f', {tries} trial boots\n' if state == 0x01 else '\n'
+
+    def confirmSlot(self, name):
+        # Confirm the image of a slot, it boots from now on.
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['SLOT'], SLOT_CONFIRM, list(SLOTS).index(name)])
+        if self.serial.read(1) == bytes([ACK]):
+            yield f'Slot {name} confirmed\n'
+        else:
+            yield f'Slot {name} holds no valid image!\n'
+            errors = self.serial.read(toInt(self.serial.read(1)))
+            for err in errors:
+                yield ERRORS[err] + '\n'
+
+    def wake(self, duration):
+        # Send wake bytes for `duration` seconds while the board is reset : the boot decision
+        # sees the traffic on the RX line and starts the bootloader instead of the application.
+        end = time.time() + duration
+        while time.time() < end:
+            self.serial.write(bytes([WAKE_BYTE]) * 8)
+            time.sleep(0.001)
+        time.sleep(0.05)
+        self.serial.flushInput()
+
+    def bootStats(self):
+        # Latency of the last auto-boot and of this boot, measured from the reset.
+        data = self.readStats(STATS_BOOT)
+        if data is None or len(data) < 16:
+            return None
+        boot, decision, window, ready = struct.unpack('<4I', data[:16])
+        return {'boot_us': boot, 'decision_us': decision, 'window_ms': window, 'ready_us': ready}
+
+    def bootReport(self):
+        stats = self.bootStats()
+        if stats is None:
+            yield 'Unable to read the boot statistics!\n'
+            return
+        if stats['window_ms'] == BOOT_WINDOW_OFF:
+            yield 'Auto-boot disabled\n'
+        else:
+            yield f'Auto-boot after {stats["window_ms"]} ms without host traffic\n'
+        if stats['boot_us']:
+            yield (f'Last auto-boot : application entered {stats["boot_us"]} us after reset, '
+                   f'window opened at {stats["decision_us"]} us\n')
+        else:
+            yield 'No auto-boot since power on\n'
+        yield f'This boot : command loop reached {stats["ready_us"]} us after reset\n'
+
+    def setBootWindow(self, window):
+        # Host activity window of the auto-boot, 0 boots at once, BOOT_WINDOW_OFF disables it.
+        if window > BOOT_WINDOW_MAX and window != BOOT_WINDOW_OFF:
+            yield f'Window above {BOOT_WINDOW_MAX} ms\n'
+            return
+        self.serial.flushInput()
+        self.serial.write([COMMANDS['BOOT_WINDOW']] + list(struct.pack('<H', window)))
+        ret = self.serial.read(1)
+        if ret == bytes([ACK]):
+            yield 'Auto-boot disabled\n' if window == BOOT_WINDOW_OFF else f'Auto-boot window set to {window} ms\n'
+        else:
+            yield 'Unable to set the auto-boot window!\n'
+            errors = self.serial.read(toInt(self.serial.read(1)))
+            for err in errors:
+                yield ERRORS[err] + '\n'
+
     def unlockFlash(self):
         self.serial.write([COMMANDS['FLACH_UNLOCK']])
         #  check for acknowledgement by read the received byte
         ret = self.serial.read(1)
         try:
-            if ret == ACK:
+            if ret == bytes([ACK]):
                 yield 'Flash has been unlocked successfully!'
             else:
                 # raise an error if not receiving an ack
@@ -135,12 +1338,12 @@ class STM32Flasher(object):
                 yield ERRORS[err] + '\n'
 
     def lockFlash(self):
-        self.serial.write([COMMANDS['FLACH_LOCK']])
+        self.serial.write([COMMANDS['FLASH_LOCK']])
         #  check for acknowledgement by read the received byte
         ret = self.serial.read(1)
         try:
-            if ret == ACK:
-                yield 'Flash has been unlocked successfully!'
+            if ret == bytes([ACK]):
+                yield 'Flash has been locked successfully!'
             else:
                 # raise an error if not receiving an ack
                 raise ProgramModeError("Error Occurred!")
@@ -155,11 +1358,156 @@ class STM32Flasher(object):
 
 if __name__ == '__main__':
 
-    com_port = 'COM' + input('Serial communication on COM: ')
+    parser = argparse.ArgumentParser(description='Program an Intel HEX image through the bootloader.')
+    parser.add_argument('hexfile', nargs='?', help='hex file path')
+    parser.add_argument('-p', '--port', help='serial port (COMx, /dev/ttyUSBx)')
+    parser.add_argument('-m', '--mode', choices=['block', 'window', 'ext', 'lz4', 'staged', 'write', 'resume'],
+                        default='ext',
+                        help='block: one ACK per 16 bytes, window: pipelined 16 bytes frames, '
+                             'ext: pipelined large frames (default), lz4: pipelined compressed frames, '
+                             'staged: large frames collected in RAM, each 16 KB erased and programmed at once, '
+                             'write: the hex segments as they are, coalesced into words by the bootloader, '
+                             'resume: large frames journaled by the bootloader, a lost transfer resumes '
+                             'where it stopped')
+    parser.add_argument('-w', '--window', type=int, default=WINDOW_SIZE, help='frames in flight for the window mode')
+    parser.add_argument('--engine-benchmark', type=int, metavar='SECTOR',
+                        help='erase SECTOR and compare the HAL and RAM engine programming cycles')
+    parser.add_argument('--verify', action='store_true',
+                        help='check the CRC of the image on the device after writing it')
+    parser.add_argument('--blank-check', action='store_true',
+                        help='report which sectors of the device are blank')
+    parser.add_argument('--boot-window', type=int, metavar='MS',
+                        help=f'set the host activity window of the auto-boot, 0 boots at once, '
+                             f'{BOOT_WINDOW_OFF} disables the auto-boot')
+    parser.add_argument('--header', type=int, metavar='VERSION',
+                        help='put an image header in front of the image (linked for the slot), lock the '
+                             'flash after writing so the bootloader verifies it once, a new image boots '
+                             'on trial until it confirms')
+    parser.add_argument('--slot', choices=list(SLOTS), default='A',
+                        help='slot of the image header (default A), the image must be linked for it')
+    parser.add_argument('--image-info', action='store_true',
+                        help='report the image header of the slot and its verification state')
+    parser.add_argument('--slots', action='store_true',
+                        help='report the image and the boot state of every slot')
+    parser.add_argument('--confirm', choices=list(SLOTS),
+                        help='confirm the image of a slot and boot it from now on')
+    parser.add_argument('--wake', type=float, metavar='SECONDS',
+                        help='keep the board in the bootloader, reset it within SECONDS')
+    parser.add_argument('--boot-report', action='store_true',
+                        help='report the auto-boot window and the reset to application latency')
+    parser.add_argument('--ram', action='store_true',
+                        help='load the image (linked for the RAM area) into the bootloader RAM and run it, '
+                             'the flash is left untouched')
+    parser.add_argument('--applet', metavar='BIN',
+                        help='load a flash applet (Applets/*.bin) and call it, see --applet-args and --applet-data')
+    parser.add_argument('--applet-args', nargs=3, type=lambda value: int(value, 0), default=(0, 0, 0),
+                        metavar=('PARAM', 'DST', 'SIZE'), help='parameter and destination area of the applet')
+    parser.add_argument('--applet-data', metavar='FILE', help='binary file handed to the applet as its source')
+    parser.add_argument('--journal', action='store_true',
+                        help='show the update journal (image being written and bytes already programmed)')
+    parser.add_argument('--wear', action='store_true',
+                        help='report the erase count and erase time of every sector of the device')
+    parser.add_argument('--wire-report', action='store_true',
+                        help='only print the bytes each mode sends for the image, no device needed')
+    parser.add_argument('-i', '--incremental', action='store_true',
+                        help='read the block CRCs of the device and only send the blocks that changed')
+    parser.add_argument('--delta', metavar='OLD_HEXFILE',
+                        help='send the image as a delta against OLD_HEXFILE, the image installed on the device')
+    parser.add_argument('--dest', type=lambda value: int(value, 0),
+                        help='where the delta builds the image (erased, outside of the installed image)')
+    parser.add_argument('--copy', nargs=3, type=lambda value: int(value, 0), metavar=('SRC', 'DEST', 'SIZE'),
+                        help='copy SIZE bytes of the device flash from SRC to DEST, no image needed')
+    parser.add_argument('-b', '--baudrate', type=int, default=115200, help='initial baud rate (default 115200)')
+    parser.add_argument('--fast', action='store_true',
+                        help='negotiate the fastest baud rate the link sustains before programming')
+    parser.add_argument('--benchmark', nargs=2, type=int, metavar=('SECTOR', 'NB_SECTORS'),
+                        help='erase the sectors and program the image with every mode to compare the throughput')
+    args = parser.parse_args()
+
+    if args.wire_report:
+        for msg in STM32Flasher.wireReport(args.hexfile or input('Hex File path: ')):
+            print(msg, end='')
+        sys.exit(0)
+
+    com_port = args.port or 'COM' + input('Serial communication on COM: ')
+
+    # commands working on the device only don't need an image.
+    file_path = args.hexfile or (args.engine_benchmark is None and not args.blank_check and not args.copy
+                                 and not args.wear and not args.boot_report and not args.journal
+                                 and args.applet is None
+                                 and args.boot_window is None and not args.image_info
+                                 and not args.slots and args.confirm is None
+                                 and input('Hex File path: '))
 
-    file_path = input('Hex File path: ')
+    if args.header is not None:
+        file_path = addHeader(file_path, args.header, SLOTS[args.slot])
 
-    flasher = STM32Flasher(com_port)
+    flasher = STM32Flasher(com_port, args.baudrate)
 
-    for msg in flasher.writeImage(file_path):
+    if args.wake:
+        print(f'Reset the board within {args.wake} s')
+        flasher.wake(args.wake)
+
+    if args.fast:
+        print(f'Link running at {flasher.probeBaudrate()} baud')
+
+    if args.engine_benchmark is not None:
+        messages = flasher.engineBenchmark(args.engine_benchmark)
+    elif args.blank_check:
+        messages = flasher.blankReport()
+    elif args.boot_window is not None:
+        messages = flasher.setBootWindow(args.boot_window)
+    elif args.image_info:
+        messages = flasher.imageReport(SLOTS[args.slot])
+    elif args.slots:
+        messages = flasher.slotReport()
+    elif args.confirm:
+        messages = flasher.confirmSlot(args.confirm)
+    elif args.boot_report:
+        messages = flasher.bootReport()
+    elif args.wear:
+        messages = flasher.wearReport()
+    elif args.journal:
+        messages = flasher.journalReport()
+    elif args.applet:
+        messages = flasher.runApplet(args.applet, args.applet_args[0], tuple(args.applet_args[1:]), args.applet_data)
+    elif args.ram:
+        messages = flasher.runImageRam(file_path)
+    elif args.copy:
+        messages = flasher.copyImage(*args.copy)
+    elif args.incremental:
+        messages = flasher.writeImageIncremental(file_path)
+    elif args.delta:
+        if args.dest is None:
+            parser.error('--delta needs --dest')
+        messages = flasher.writeImageDelta(file_path, args.delta, args.dest)
+    elif args.benchmark:
+        messages = flasher.benchmark(file_path, *args.benchmark)
+    elif args.mode == 'write':
+        messages = flasher.writeImageCoalesced(file_path)
+    elif args.mode == 'staged':
+        messages = flasher.writeImageStaged(file_path)
+    elif args.mode == 'lz4':
+        messages = flasher.writeImageCompressed(file_path)
+    elif args.mode == 'resume':
+        messages = flasher.writeImageResumable(file_path)
+    elif args.mode == 'ext':
+        messages = flasher.writeImageExtended(file_path)
+    elif args.mode == 'window':
+        messages = flasher.writeImageWindowed(file_path, args.window)
+    else:
+        messages = flasher.writeImage(file_path)
+
+    for msg in messages:
         print(msg, end='')
+
+    if args.verify:
+        for msg in flasher.verifyImage(file_path):
+            print(msg, end='')
+
+    if args.header is not None:
+        print()
+        for msg in flasher.lockFlash():
+            print(msg)
+        for msg in flasher.slotReport():
+            print(msg, end='')